@@ -0,0 +1,275 @@
+/* Copyright (C) 2020 D8DATAWORKS - All Rights Reserved */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <sched.h>
+#endif
+
+#include "cpu.hpp"
+#include "encrypt.hpp"
+#include "decrypt.hpp"
+
+#include "d8u/memory.hpp"
+
+namespace template_crypto
+{
+    namespace bench
+    {
+        // Sweep of INT type x block size x message size for encrypt, decrypt and key setup.
+        // Every point is warmed up, then timed as a number of samples, each long enough to dwarf the clock.
+        // Cycles are time stamp counter ticks, which run at the nominal clock whatever the core is doing.
+        //
+
+        struct Options
+        {
+            size_t min_bytes = 16;
+            size_t max_bytes = 64 * 1024 * 1024;
+            size_t samples = 15;
+            size_t warmup = 2;
+            double sample_seconds = 0.002;
+
+            // -1 leaves the thread where the scheduler put it, -2 pins it to the cpu it starts on.
+            //
+
+            int cpu = -2;
+
+            std::string type;
+            size_t block = 0;
+            std::string op;
+        };
+
+        struct Result
+        {
+            std::string op;
+            std::string type;
+            size_t block = 0;
+            size_t bytes = 0;
+            size_t samples = 0;
+            size_t iterations = 0;
+
+            double ns_median = 0;
+            double ns_p10 = 0;
+            double ns_p90 = 0;
+            double ns_p99 = 0;
+
+            double gbps = 0;
+            double cycles_per_byte = 0;
+        };
+
+        inline int Pin(int cpu)
+        {
+#if defined(_WIN32)
+            if (cpu == -2)
+                cpu = (int)GetCurrentProcessorNumber();
+            if (cpu < 0)
+                return -1;
+
+            return SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu) ? cpu : -1;
+#elif defined(__linux__)
+            if (cpu == -2)
+                cpu = sched_getcpu();
+            if (cpu < 0)
+                return -1;
+
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+
+            return sched_setaffinity(0, sizeof(set), &set) == 0 ? cpu : -1;
+#else
+            return -1;
+#endif
+        }
+
+        inline uint64_t Ticks()
+        {
+#if TCRYPT_X86
+            return __rdtsc();
+#else
+            return 0;
+#endif
+        }
+
+        // Make the optimizer assume value is read, so work that only produces it is not dropped.
+        //
+
+        template <typename T> void Keep(T& value)
+        {
+#if defined(__GNUC__) || defined(__clang__)
+            asm volatile("" : : "r"(&value) : "memory");
+#else
+            static volatile uint8_t sink;
+            sink = *(volatile uint8_t*)&value;
+#endif
+        }
+
+        template <typename F> Result Measure(const char* op, const char* type, size_t block, size_t bytes, const Options& options, F&& f)
+        {
+            using clock = std::chrono::steady_clock;
+
+            auto seconds = [](clock::duration d) { return std::chrono::duration<double>(d).count(); };
+
+            // One call sizes the samples, small messages repeat until a sample is long enough to time.
+            //
+
+            auto start = clock::now();
+            f();
+            double once = std::max(seconds(clock::now() - start), 1e-9);
+
+            size_t iterations = std::max(size_t(1), size_t(options.sample_seconds / once));
+
+            for (size_t i = 0; i < options.warmup * iterations; i++)
+                f();
+
+            std::vector<double> ns, cycles;
+
+            for (size_t s = 0; s < options.samples; s++)
+            {
+                auto t1 = clock::now();
+                auto c1 = Ticks();
+
+                for (size_t i = 0; i < iterations; i++)
+                    f();
+
+                auto c2 = Ticks();
+                auto t2 = clock::now();
+
+                ns.push_back(seconds(t2 - t1) * 1e9 / iterations);
+                cycles.push_back(double(c2 - c1) / iterations);
+            }
+
+            std::sort(ns.begin(), ns.end());
+            std::sort(cycles.begin(), cycles.end());
+
+            auto percentile = [](const std::vector<double>& v, double q) { return v[std::min(v.size() - 1, size_t(q * (v.size() - 1) + 0.5))]; };
+
+            Result r{ op, type, block, bytes, options.samples, iterations };
+
+            r.ns_median = percentile(ns, 0.5);
+            r.ns_p10 = percentile(ns, 0.1);
+            r.ns_p90 = percentile(ns, 0.9);
+            r.ns_p99 = percentile(ns, 0.99);
+
+            r.gbps = bytes ? bytes / r.ns_median : 0;
+            r.cycles_per_byte = bytes ? percentile(cycles, 0.5) / bytes : percentile(cycles, 0.5);
+
+            return r;
+        }
+
+        template <typename INT, size_t block> void Sweep(std::vector<Result>& results, d8u::aligned_vector& buffer, const Options& options, const char* type)
+        {
+            if ((!options.type.empty() && options.type != type) || (options.block && options.block != block))
+                return;
+
+            std::array<INT, block> key, iv;
+
+            for (size_t i = 0; i < block; i++)
+            {
+                key[i] = INT(73 + 10 * i);
+                iv[i] = INT(46 + 7 * i);
+            }
+
+            auto wanted = [&](const char* op) { return options.op.empty() || options.op == op; };
+
+            // Setup is reported per schedule, cycles_per_byte then holds cycles per setup.
+            //
+
+            if (wanted("setup"))
+            {
+                results.push_back(Measure("setup", type, block, 0, options, [&]()
+                {
+                    encrypt::Long<INT, block> lec(key, iv);
+                    decrypt::Long<INT, block> ldc(key, iv);
+
+                    Keep(lec);
+                    Keep(ldc);
+                }));
+            }
+
+            encrypt::Long<INT, block> lec(key, iv);
+            decrypt::Long<INT, block> ldc(key, iv);
+
+            for (size_t bytes = 16; bytes <= options.max_bytes && bytes <= buffer.size(); bytes *= 4)
+            {
+                if (bytes < options.min_bytes)
+                    continue;
+
+                if (wanted("encrypt"))
+                    results.push_back(Measure("encrypt", type, block, bytes, options, [&]() { lec.Encrypt(buffer.data(), buffer.data(), bytes); }));
+
+                if (wanted("decrypt"))
+                    results.push_back(Measure("decrypt", type, block, bytes, options, [&]() { ldc.Decrypt(buffer.data(), buffer.data(), bytes); }));
+            }
+        }
+
+        template <typename INT, size_t... blocks> void SweepBlocks(std::vector<Result>& results, d8u::aligned_vector& buffer, const Options& options, const char* type)
+        {
+            (Sweep<INT, blocks>(results, buffer, options, type), ...);
+        }
+
+        inline std::vector<Result> Run(const Options& options)
+        {
+            std::vector<Result> results;
+
+            size_t largest = 16;
+
+            while (largest * 4 <= options.max_bytes)
+                largest *= 4;
+
+            d8u::aligned_vector buffer(largest);
+
+            for (size_t i = 0; i < buffer.size(); i++)
+                buffer[i] = uint8_t(i * 131 + 7);
+
+            SweepBlocks<uint8_t, 2, 4, 8, 16, 32, 64>(results, buffer, options, "u8");
+            SweepBlocks<uint16_t, 2, 4, 8, 16, 32, 64>(results, buffer, options, "u16");
+            SweepBlocks<uint32_t, 2, 4, 8, 16, 32, 64>(results, buffer, options, "u32");
+            SweepBlocks<uint64_t, 2, 4, 8, 16, 32, 64>(results, buffer, options, "u64");
+#if defined(__SIZEOF_INT128__)
+            SweepBlocks<unsigned __int128, 2, 4, 8, 16, 32, 64>(results, buffer, options, "u128");
+#endif
+            return results;
+        }
+
+        inline void WriteCsv(std::ostream& out, const std::vector<Result>& results)
+        {
+            out << "op,type,block,bytes,kernel,samples,iterations,ns_median,ns_p10,ns_p90,ns_p99,gbps,cycles_per_byte" << std::endl;
+
+            for (auto& r : results)
+            {
+                out << r.op << ',' << r.type << ',' << r.block << ',' << r.bytes << ',' << cpu::Name(cpu::Active()) << ',' << r.samples << ',' << r.iterations << ','
+                    << r.ns_median << ',' << r.ns_p10 << ',' << r.ns_p90 << ',' << r.ns_p99 << ',' << r.gbps << ',' << r.cycles_per_byte << std::endl;
+            }
+        }
+
+        inline void WriteJson(std::ostream& out, const std::vector<Result>& results, int cpu)
+        {
+            out << "{\n  \"kernel\": \"" << cpu::Name(cpu::Active()) << "\",\n  \"cpu\": " << cpu << ",\n  \"results\": [";
+
+            for (size_t i = 0; i < results.size(); i++)
+            {
+                auto& r = results[i];
+
+                out << (i ? ",\n" : "\n") << "    { \"op\": \"" << r.op << "\", \"type\": \"" << r.type << "\", \"block\": " << r.block << ", \"bytes\": " << r.bytes
+                    << ", \"samples\": " << r.samples << ", \"iterations\": " << r.iterations
+                    << ", \"ns_median\": " << r.ns_median << ", \"ns_p10\": " << r.ns_p10 << ", \"ns_p90\": " << r.ns_p90 << ", \"ns_p99\": " << r.ns_p99
+                    << ", \"gbps\": " << r.gbps << ", \"cycles_per_byte\": " << r.cycles_per_byte << " }";
+            }
+
+            out << "\n  ]\n}" << std::endl;
+        }
+    }
+}
@@ -2,7 +2,13 @@
 
 #pragma once
 
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
 #include "math.hpp"
+#include "perf.hpp"
+#include "simd.hpp"
 
 #include "../gsl-lite.hpp"
 
@@ -12,18 +18,51 @@ namespace template_crypto
     {
         using namespace math;
 
-        template <typename T, size_t side> class EncodeContextLong
+        template <typename T> gsl::span<const uint8_t> const_byte_buffer(const T& t)
+        {
+            return gsl::span<const uint8_t>((const uint8_t*)t.data(), t.size() * sizeof(*t.data()));
+        }
+
+        // Zero memory that held key material. A plain memset of an object about to die is a dead store
+        // the optimizer removes, the barrier or the volatile stores here keep it.
+        //
+
+        inline void Wipe(void* data, size_t size)
+        {
+#if defined(__GNUC__) || defined(__clang__)
+            std::memset(data, 0, size);
+            __asm__ __volatile__("" : : "r"(data) : "memory");
+#else
+            volatile uint8_t* bytes = (volatile uint8_t*)data;
+
+            while (size--)
+                *bytes++ = 0;
+#endif
+        }
+
+        template <typename T> void Wipe(T& t)
+        {
+            static_assert(std::is_trivially_copyable<T>(), "only plain key material is wiped in place");
+
+            Wipe((void*)&t, sizeof(t));
+        }
+
+        template <typename T, size_t side, bool additive = true> class EncodeContextLong
         {
         public:
 
             constexpr EncodeContextLong(const std::array<T, side>& symmetry) : et(symmetry) {}
 
-            const auto& Pascal() const { return pt; }
-            const auto& Transform() const { return et; }
+            constexpr const auto& Pascal() const { return pt; }
+            constexpr const auto& Transform() const { return et; }
 
-            template <typename SRC, typename TMP, typename DEST> void Run(const SRC& source, TMP& scratch, DEST& dest)
+            template <typename SRC, typename TMP, typename DEST> void Run(const SRC& source, TMP& scratch, DEST& dest) const
             {
-                ToPascal(source, scratch, Pascal());
+                if constexpr (additive)
+                    ToPascalAdditive(source, scratch);
+                else
+                    ToPascal(source, scratch, Pascal());
+
                 ToPolynomial(scratch, dest, Transform());
             }
 
@@ -32,19 +71,39 @@ namespace template_crypto
             ElectiveTransform<T,side> et;
         };
 
-        template <typename T, size_t side> class EncodeContextLong2
+        template <typename T, size_t side, bool additive = true> class EncodeContextLong2
         {
         public:
 
             constexpr EncodeContextLong2(const std::array<T, side>& symmetry) : et(symmetry) {}
 
-            const auto& Pascal() const { return pt; }
-            const auto& Transform() const { return et; }
+            constexpr const auto& Pascal() const { return pt; }
+            constexpr const auto& Transform() const { return et; }
 
-            template <typename SRC, typename TMP, typename DEST> void Run(const SRC& source, TMP& scratch, DEST& dest)
+            // Only large blocks are counted, a smaller one runs in less time than the two reads of a scope.
+            //
+
+            template <typename SRC, typename TMP, typename DEST> void Run(const SRC& source, TMP& scratch, DEST& dest) const
             {
-                ToPascal(source, scratch, Pascal());
-                ToPolynomial2(scratch, dest, Transform());
+                TCRYPT_PERF_SCOPE_IF(EncodeRun, side >= large_block_threshold);
+
+                if constexpr (additive)
+                    ToPascalAdditive(source, scratch);
+                else
+                    ToPascal(source, scratch, Pascal());
+
+                if constexpr (side >= large_block_threshold)
+                    ToPolynomialLarge(scratch, dest, Transform());
+                else
+                    ToPolynomial2(scratch, dest, Transform());
+            }
+
+            template <typename SRC, typename DEST> void Run(const SRC* source, DEST* dest, size_t count) const
+            {
+                std::array<T, side> scratch;
+
+                for (size_t i = 0; i < count; i++)
+                    Run(source[i], scratch, dest[i]);
             }
 
         private:
@@ -52,14 +111,39 @@ namespace template_crypto
             ElectiveTransform2<T, side> et;
         };
 
+        template <typename T, size_t side> class EncodeContextFused
+        {
+        public:
+
+            constexpr EncodeContextFused(const std::array<T, side>& symmetry) : ft(ElectiveTransform2<T, side>(symmetry)) {}
+
+            constexpr const auto& Transform() const { return ft; }
+
+            template <typename SRC, typename TMP, typename DEST> void Run(const SRC& source, TMP& scratch, DEST& dest) const
+            {
+                ToFused(source, scratch, Transform());
+
+                for (size_t i = 0; i < side; i++)
+                    dest[i] = scratch[i];
+            }
+
+            template <typename SRC, typename DEST> void Run(const SRC* source, DEST* dest, size_t count) const
+            {
+                simd::ToFusedBatch(source, dest, count, Transform());
+            }
+
+        private:
+            FusedTransform<T, side> ft;
+        };
+
         template <typename T, size_t side> class EncodeContextShort
         {
         public:
             constexpr EncodeContextShort(const std::array<T, side>& symmetry) : et(symmetry) {}
 
-            const auto& Transform() const { return et; }
+            constexpr const auto& Transform() const { return et; }
 
-            template <typename SRC, typename DEST> void Run(const SRC& source, DEST & dest)
+            template <typename SRC, typename DEST> void Run(const SRC& source, DEST & dest) const
             {
                 ToPolynomial(source, dest, Transform());
             }
@@ -68,39 +152,77 @@ namespace template_crypto
             ElectiveTransform<T,side> et;
         };
 
-        template <typename T, size_t side> class DecodeContextShort
+        // layout picks the row storage of the symmetry, see math::Layout. Large blocks only keep row 0 and stay compact.
+        //
+
+        template <typename T, size_t side, Layout layout = Layout::Compact> class DecodeContextShort
         {
         public:
             constexpr DecodeContextShort(const std::array<T, side>& symmetry) : es(symmetry) { }
 
-            const auto& Symmetry() const { return es; }
+            constexpr const auto& Symmetry() const { return es; }
+
+            // Only large blocks are counted, as in EncodeContextLong2.
+            //
+
+            template <typename SRC, typename DEST> void Run(const SRC& source, DEST& dest) const
+            {
+                TCRYPT_PERF_SCOPE_IF(DecodeRun, side >= large_block_threshold);
+
+                if constexpr (side >= large_block_threshold)
+                    ToFunctionLarge(source, dest, Symmetry());
+                else
+                    ToFunction(source, dest, Symmetry());
+            }
 
-            template <typename SRC, typename DEST> void Run(const SRC& source, DEST& dest)
+            template <typename SRC, typename DEST> void Run(const SRC* source, DEST* dest, size_t count) const
             {
-                ToFunction(source, dest, Symmetry());
+                if constexpr (side >= large_block_threshold)
+                {
+                    for (size_t i = 0; i < count; i++)
+                        Run(source[i], dest[i]);
+                }
+                else
+                    simd::ToFunctionBatch(source, dest, count, Symmetry());
             }
 
         private:
-            ElectiveSymmetry<side,T,side> es;
+            ElectiveSymmetry<(side >= large_block_threshold) ? 1 : side, T, side, (side >= large_block_threshold) ? Layout::Compact : layout> es;
         };
 
-        template <typename T, size_t side> class DecodeContextLong
+        template <typename T, size_t side, bool additive = true> class DecodeContextLong
         {
         public:
             constexpr DecodeContextLong(const std::array<T, side>& symmetry) : es(symmetry) { }
 
-            const auto& Symmetry() const { return es; }
-            const auto& Pascal() const { return pt; }
+            constexpr const auto& Symmetry() const { return es; }
+            constexpr const auto& Pascal() const { return pt; }
 
-            template <typename SRC, typename TMP, typename DEST> void Run(const SRC& source, const TMP& scratch, DEST& dest)
+            template <typename SRC, typename TMP, typename DEST> void Run(const SRC& source, TMP& scratch, DEST& dest) const
             {
-                ToFunction(source, scratch, Symmetry());
-                ToPascal(scratch, dest, Pascal());
+                if constexpr (side >= large_block_threshold)
+                    ToFunctionLarge(source, scratch, Symmetry());
+                else
+                    ToFunction(source, scratch, Symmetry());
+
+                if constexpr (additive)
+                    ToPascalAdditive(scratch, dest);
+                else
+                    ToPascal(scratch, dest, Pascal());
             }
 
         private:
-            PascalTriangle<T,side> pt;
-            ElectiveSymmetry<side,T,side> es;
+            static constexpr PascalTriangle<T, side> pt = PascalTriangle<T, side>();
+            ElectiveSymmetry<(side >= large_block_threshold) ? 1 : side, T, side> es;
         };
+
+        // The fused matrix is side^2 words held in every context and costs O(side^3) to build per key.
+        // It runs 2 to 10 times faster than the staged context at every size, but at u64 the setup is 0.2 ms at side 64 (32 KiB)
+        // and 16 ms at side 256 (512 KiB), so contexts only take it while the matrix fits in fused_bytes_threshold.
+        //
+
+        constexpr size_t fused_bytes_threshold = 32 * 1024;
+
+        template <typename T, size_t side> using EncodeContext = std::conditional_t<(side * side * sizeof(T) <= fused_bytes_threshold), EncodeContextFused<T, side>, EncodeContextLong2<T, side>>;
     }
 }
\ No newline at end of file
@@ -0,0 +1,236 @@
+/* Copyright (C) 2020 D8DATAWORKS - All Rights Reserved */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "block.hpp"
+
+namespace template_crypto
+{
+    namespace cache
+    {
+        // Expanded keys for callers that switch keys often, so a returning key skips the setup.
+        // CIPHER is encrypt::Long, decrypt::Long or anything else built from a key and an iv.
+        // Schedules depend on the key alone and are built under a zero iv, callers pass each message's iv
+        // to the Encrypt and Decrypt overloads that take one.
+        // Schedules are shared and immutable, the const Encrypt and Decrypt of one may run on any number of threads.
+        //
+        // The cache is split into shards by fingerprint, each an LRU list under its own lock.
+        // An evicted entry drops its reference and wipes its copy of the key, the schedule itself is wiped
+        // by its destructor once the last caller holding it lets go.
+        //
+
+        template <typename CIPHER> class Cache
+        {
+        public:
+
+            struct Stats
+            {
+                uint64_t hits = 0;
+                uint64_t misses = 0;
+                uint64_t evictions = 0;
+
+                size_t entries = 0;
+                size_t bytes = 0;
+            };
+
+            // budget_bytes bounds the schedules held by the cache, at least one per shard is always kept.
+            //
+
+            Cache(size_t budget_bytes = 64 * 1024 * 1024, size_t shards = 16)
+            {
+                size_t capacity = std::max(size_t(1), budget_bytes / sizeof(CIPHER));
+
+                shards = std::max(size_t(1), std::min(shards, capacity));
+
+                per_shard = capacity / shards;
+                parts = std::vector<Shard>(shards);
+
+                // Fingerprints are seeded per cache, so keys cannot be picked to collide in the buckets.
+                //
+
+                std::random_device rd;
+                seed = (uint64_t(rd()) << 32) ^ rd();
+            }
+
+            ~Cache()
+            {
+                Clear();
+            }
+
+            Cache(const Cache&) = delete;
+            Cache& operator=(const Cache&) = delete;
+
+            template <typename INT, size_t block> std::shared_ptr<const CIPHER> Get(const std::array<INT, block>& key)
+            {
+                uint8_t material[sizeof(INT) * block];
+
+                std::memcpy(material, key.data(), sizeof(key));
+
+                uint64_t fingerprint = Fingerprint(material, sizeof(material));
+                auto& shard = parts[fingerprint % parts.size()];
+
+                {
+                    std::lock_guard<std::mutex> lock(shard.mutex);
+
+                    auto schedule = Find(shard, fingerprint, material, sizeof(material));
+
+                    if (schedule)
+                    {
+                        hits.fetch_add(1, std::memory_order_relaxed);
+                        template_crypto::block::Wipe(material);
+
+                        return schedule;
+                    }
+                }
+
+                misses.fetch_add(1, std::memory_order_relaxed);
+
+                // Expanded outside the lock, so a slow setup does not hold up lookups of other keys.
+                // Two threads missing on the same key both build it and the first one in is kept.
+                //
+
+                auto built = std::make_shared<const CIPHER>(key, std::array<INT, block>{});
+
+                std::lock_guard<std::mutex> lock(shard.mutex);
+
+                auto schedule = Find(shard, fingerprint, material, sizeof(material));
+
+                if (!schedule)
+                {
+                    auto found = shard.index.find(fingerprint);
+
+                    if (found != shard.index.end())
+                        Evict(shard, found->second);
+
+                    while (shard.entries.size() >= per_shard)
+                        Evict(shard, std::prev(shard.entries.end()));
+
+                    shard.entries.push_front(Entry{ fingerprint, std::vector<uint8_t>(material, material + sizeof(material)), built });
+                    shard.index[fingerprint] = shard.entries.begin();
+
+                    schedule = built;
+                }
+
+                template_crypto::block::Wipe(material);
+
+                return schedule;
+            }
+
+            void Clear()
+            {
+                for (auto& shard : parts)
+                {
+                    std::lock_guard<std::mutex> lock(shard.mutex);
+
+                    while (!shard.entries.empty())
+                        Evict(shard, shard.entries.begin(), false);
+                }
+            }
+
+            Stats Metrics() const
+            {
+                Stats stats;
+
+                stats.hits = hits.load(std::memory_order_relaxed);
+                stats.misses = misses.load(std::memory_order_relaxed);
+                stats.evictions = evictions.load(std::memory_order_relaxed);
+
+                for (auto& shard : parts)
+                {
+                    std::lock_guard<std::mutex> lock(shard.mutex);
+                    stats.entries += shard.entries.size();
+                }
+
+                stats.bytes = stats.entries * sizeof(CIPHER);
+
+                return stats;
+            }
+
+        private:
+
+            struct Entry
+            {
+                uint64_t fingerprint;
+                std::vector<uint8_t> material;
+                std::shared_ptr<const CIPHER> schedule;
+            };
+
+            struct Shard
+            {
+                mutable std::mutex mutex;
+
+                std::list<Entry> entries;
+                std::unordered_map<uint64_t, typename std::list<Entry>::iterator> index;
+            };
+
+            uint64_t Fingerprint(const uint8_t* data, size_t size) const
+            {
+                uint64_t h = seed ^ size;
+
+                for (size_t i = 0; i < size; i += sizeof(uint64_t))
+                {
+                    uint64_t word = 0;
+                    std::memcpy(&word, data + i, std::min(sizeof(word), size - i));
+
+                    h ^= word;
+                    h *= 0x9e3779b97f4a7c15ull;
+                    h ^= h >> 29;
+                }
+
+                h ^= h >> 32;
+                h *= 0xd6e8feb86659fd93ull;
+
+                return h ^ (h >> 32);
+            }
+
+            std::shared_ptr<const CIPHER> Find(Shard& shard, uint64_t fingerprint, const uint8_t* material, size_t size)
+            {
+                auto found = shard.index.find(fingerprint);
+
+                if (found == shard.index.end())
+                    return nullptr;
+
+                auto entry = found->second;
+
+                if (entry->material.size() != size || std::memcmp(entry->material.data(), material, size) != 0)
+                    return nullptr;
+
+                shard.entries.splice(shard.entries.begin(), shard.entries, entry);
+
+                return entry->schedule;
+            }
+
+            void Evict(Shard& shard, typename std::list<Entry>::iterator entry, bool count = true)
+            {
+                template_crypto::block::Wipe(entry->material.data(), entry->material.size());
+
+                shard.index.erase(entry->fingerprint);
+                shard.entries.erase(entry);
+
+                if (count)
+                    evictions.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            std::vector<Shard> parts;
+            size_t per_shard = 1;
+
+            uint64_t seed = 0;
+
+            std::atomic<uint64_t> hits{ 0 };
+            std::atomic<uint64_t> misses{ 0 };
+            std::atomic<uint64_t> evictions{ 0 };
+        };
+    }
+}
@@ -0,0 +1,272 @@
+/* Copyright (C) 2020 D8DATAWORKS - All Rights Reserved */
+
+#pragma once
+
+#include <algorithm>
+
+#include "encrypt.hpp"
+#include "decrypt.hpp"
+#include "ctr.hpp"
+#include "parallel.hpp"
+
+#include "d8u/buffer.hpp"
+
+namespace template_crypto
+{
+    namespace container
+    {
+        using namespace block;
+
+        // Framed format for payloads too large for one chain.
+        // The payload is cut into fixed size chunks, each its own CBC message under an iv taken from the whitened
+        // counter keystream at block index, so chunks encrypt and decrypt on any number of threads and a reader can
+        // open any one of them alone. The counter starts from the iv xor 0x5c in every byte, which keeps the chunk ivs
+        // apart from the keystream of a ctr::Long under the same key and iv.
+        //
+        // Layout, little endian:
+        //   magic "TCC2", block bytes u32, chunk size u64, payload size u64, chunk count u64
+        //   chunk count u64 offsets from the start of the container
+        //   the chunks, each as long as the plaintext it holds
+        //
+
+        constexpr size_t default_chunk = 1024 * 1024;
+
+        template < typename INT, size_t block, bool steal = false > class Long
+        {
+        public:
+
+            static constexpr size_t block_bytes() { return sizeof(INT) * block; }
+
+            static constexpr size_t header_bytes = 32;
+
+            // Rounded up without forming size + chunk - 1, which wraps for a forged size. A zero chunk has no chunks.
+            //
+
+            static constexpr size_t Chunks(size_t size, size_t chunk = default_chunk)
+            {
+                return chunk ? size / chunk + (size % chunk ? 1 : 0) : 0;
+            }
+
+            // Container bytes for a payload of size bytes.
+            //
+
+            static constexpr size_t Size(size_t size, size_t chunk = default_chunk)
+            {
+                return header_bytes + Chunks(size, chunk) * sizeof(uint64_t) + size;
+            }
+
+            Long(const std::array<INT, block>& _key, const std::array<INT, block>& _iv)
+                : cipher(_key, _iv)
+                , plain(_key, _iv)
+                , ivs(_key, Domain(_iv)) {}
+
+            // out must hold Size(plaintext.size(), chunk) bytes, returns the bytes written.
+            // Returns 0, writing nothing, if chunk is 0 or out is too small.
+            //
+
+            template <typename S, typename D> size_t Encrypt(const S& _plaintext, D& _out, size_t chunk = default_chunk, size_t threads = 0) const
+            {
+                return EncryptChunks(_plaintext, _out, chunk, [&](size_t tasks, auto&& f) { parallel::For(tasks, threads, f); });
+            }
+
+            template <typename S, typename D> size_t Encrypt(const S& _plaintext, D& _out, parallel::Pool& pool, size_t chunk = default_chunk) const
+            {
+                return EncryptChunks(_plaintext, _out, chunk, [&](size_t tasks, auto&& f) { pool.For(tasks, f); });
+            }
+
+            // Payload bytes of a container, or 0 if it is malformed.
+            //
+
+            template <typename S> static size_t PayloadSize(const S& _container)
+            {
+                auto container = const_byte_buffer(_container);
+                Header header;
+
+                return Parse(container.data(), container.size(), header) ? (size_t)header.size : 0;
+            }
+
+            template <typename S> static size_t ChunkCount(const S& _container)
+            {
+                auto container = const_byte_buffer(_container);
+                Header header;
+
+                return Parse(container.data(), container.size(), header) ? (size_t)header.chunks : 0;
+            }
+
+            // plaintext must hold PayloadSize(container) bytes.
+            // Returns false, writing nothing, if the container is malformed or plaintext is too small.
+            //
+
+            template <typename S, typename D> bool Decrypt(const S& _container, D& _plaintext, size_t threads = 0) const
+            {
+                return DecryptChunks(_container, _plaintext, [&](size_t tasks, auto&& f) { parallel::For(tasks, threads, f); });
+            }
+
+            template <typename S, typename D> bool Decrypt(const S& _container, D& _plaintext, parallel::Pool& pool) const
+            {
+                return DecryptChunks(_container, _plaintext, [&](size_t tasks, auto&& f) { pool.For(tasks, f); });
+            }
+
+            // Decrypt chunk index alone into out, which must hold the chunk size.
+            // Returns the bytes written, 0 if the container is malformed, index is out of range or out is too small.
+            //
+
+            template <typename S, typename D> size_t DecryptChunk(const S& _container, size_t index, D& _out) const
+            {
+                auto container = const_byte_buffer(_container);
+                auto out = d8u::byte_buffer(_out);
+
+                Header header;
+
+                if (!Parse(container.data(), container.size(), header) || index >= header.chunks)
+                    return 0;
+
+                size_t offset, length;
+
+                if (!Locate(container.data(), container.size(), header, index, offset, length) || out.size() < length)
+                    return 0;
+
+                plain.Decrypt(container.data() + offset, out.data(), length, Iv(index));
+
+                return length;
+            }
+
+        private:
+
+            struct Header
+            {
+                uint64_t chunk;
+                uint64_t size;
+                uint64_t chunks;
+            };
+
+            static std::array<INT, block> Domain(std::array<INT, block> _iv)
+            {
+                auto bytes = (uint8_t*)_iv.data();
+
+                for (size_t i = 0; i < block_bytes(); i++)
+                    bytes[i] ^= 0x5c;
+
+                return _iv;
+            }
+
+            std::array<INT, block> Iv(size_t index) const
+            {
+                // Not E(iv + index), which is affine in index as E is linear, see ctr::Long.
+                //
+
+                std::array<INT, block> chunk_iv = {};
+
+                ivs.Crypt((uint8_t*)chunk_iv.data(), block_bytes(), index);
+
+                return chunk_iv;
+            }
+
+            static bool Parse(const uint8_t* data, size_t size, Header& header)
+            {
+                if (size < header_bytes || std::memcmp(data, "TCC2", 4) != 0)
+                    return false;
+
+                uint32_t bytes;
+
+                std::memcpy(&bytes, data + 4, sizeof(bytes));
+                std::memcpy(&header.chunk, data + 8, sizeof(header.chunk));
+                std::memcpy(&header.size, data + 16, sizeof(header.size));
+                std::memcpy(&header.chunks, data + 24, sizeof(header.chunks));
+
+                if (bytes != block_bytes() || !header.chunk || header.chunks != Chunks((size_t)header.size, (size_t)header.chunk))
+                    return false;
+
+                // The offsets and the payload both lie within the container, which also bounds every chunk index below.
+                //
+
+                return header.chunks <= (size - header_bytes) / sizeof(uint64_t) && header.size <= size - header_bytes - header.chunks * sizeof(uint64_t);
+            }
+
+            static bool Locate(const uint8_t* data, size_t size, const Header& header, size_t index, size_t& offset, size_t& length)
+            {
+                uint64_t _offset;
+                std::memcpy(&_offset, data + header_bytes + index * sizeof(uint64_t), sizeof(_offset));
+
+                offset = (size_t)_offset;
+                length = (size_t)std::min(header.chunk, header.size - index * header.chunk);
+
+                return offset <= size && length <= size - offset;
+            }
+
+            template <typename S, typename D, typename EXEC> size_t EncryptChunks(const S& _plaintext, D& _out, size_t chunk, EXEC&& exec) const
+            {
+                auto plaintext = const_byte_buffer(_plaintext);
+                auto out = d8u::byte_buffer(_out);
+
+                if (!chunk || out.size() < Size(plaintext.size(), chunk))
+                    return 0;
+
+                uint64_t size = plaintext.size(), chunk_size = chunk;
+                uint64_t chunks = Chunks(plaintext.size(), chunk);
+                uint32_t bytes = block_bytes();
+
+                std::memcpy(out.data(), "TCC2", 4);
+                std::memcpy(out.data() + 4, &bytes, sizeof(bytes));
+                std::memcpy(out.data() + 8, &chunk_size, sizeof(chunk_size));
+                std::memcpy(out.data() + 16, &size, sizeof(size));
+                std::memcpy(out.data() + 24, &chunks, sizeof(chunks));
+
+                size_t base = header_bytes + chunks * sizeof(uint64_t);
+
+                for (size_t c = 0; c < chunks; c++)
+                {
+                    uint64_t offset = base + c * chunk;
+                    std::memcpy(out.data() + header_bytes + c * sizeof(uint64_t), &offset, sizeof(offset));
+                }
+
+                exec(chunks, [&](size_t c)
+                {
+                    size_t offset = c * chunk;
+
+                    cipher.Encrypt(plaintext.data() + offset, out.data() + base + offset, std::min(chunk, plaintext.size() - offset), Iv(c));
+                });
+
+                return base + plaintext.size();
+            }
+
+            template <typename S, typename D, typename EXEC> bool DecryptChunks(const S& _container, D& _plaintext, EXEC&& exec) const
+            {
+                auto container = const_byte_buffer(_container);
+                auto plaintext = d8u::byte_buffer(_plaintext);
+
+                Header header;
+
+                if (!Parse(container.data(), container.size(), header) || plaintext.size() < header.size)
+                    return false;
+
+                // Every chunk is located before any is decrypted, so a bad index leaves the output untouched.
+                //
+
+                std::vector<size_t> offsets((size_t)header.chunks);
+
+                for (size_t c = 0; c < offsets.size(); c++)
+                {
+                    size_t length;
+
+                    if (!Locate(container.data(), container.size(), header, c, offsets[c], length))
+                        return false;
+                }
+
+                exec(offsets.size(), [&](size_t c)
+                {
+                    size_t offset = c * (size_t)header.chunk;
+
+                    plain.Decrypt(container.data() + offsets[c], plaintext.data() + offset, std::min((size_t)header.chunk, (size_t)header.size - offset), Iv(c));
+                });
+
+                return true;
+            }
+
+            encrypt::Long<INT, block, steal> cipher;
+            decrypt::Long<INT, block, steal> plain;
+
+            ctr::Long<INT, block> ivs;
+        };
+    }
+}
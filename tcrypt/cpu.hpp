@@ -0,0 +1,135 @@
+/* Copyright (C) 2020 D8DATAWORKS - All Rights Reserved */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define TCRYPT_X86 1
+#else
+#define TCRYPT_X86 0
+#endif
+
+#if TCRYPT_X86
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#include <immintrin.h>
+#endif
+
+// Kernels are compiled for their own instruction set in every translation unit and only entered after cpuid says so.
+// MSVC emits intrinsics regardless of /arch, so the attribute is only needed on GCC and Clang.
+//
+
+#if defined(__GNUC__) || defined(__clang__)
+#define TCRYPT_TARGET(isa) __attribute__((target(isa)))
+#else
+#define TCRYPT_TARGET(isa)
+#endif
+
+// Register tiles only stay in registers once their loops are fully unrolled, which -O2 does not always do by itself.
+//
+
+#if defined(__clang__)
+#define TCRYPT_UNROLL _Pragma("unroll")
+#elif defined(__GNUC__)
+#define TCRYPT_UNROLL _Pragma("GCC unroll 16")
+#else
+#define TCRYPT_UNROLL
+#endif
+
+namespace template_crypto
+{
+    namespace cpu
+    {
+        enum class Kernel : int
+        {
+            Scalar,
+            Sse41,
+            Avx2,
+            Avx512
+        };
+
+        inline const char* Name(Kernel k)
+        {
+            switch (k)
+            {
+            case Kernel::Sse41: return "sse4.1";
+            case Kernel::Avx2: return "avx2";
+            case Kernel::Avx512: return "avx512";
+            default: return "scalar";
+            }
+        }
+
+        inline Kernel Detect()
+        {
+#if TCRYPT_X86
+#if defined(_MSC_VER)
+            int r[4];
+
+            __cpuid(r, 0);
+            int max = r[0];
+
+            __cpuid(r, 1);
+            bool sse41 = r[2] & (1 << 19);
+            bool osxsave = r[2] & (1 << 27);
+            bool avx = r[2] & (1 << 28);
+
+            uint64_t xcr0 = osxsave ? _xgetbv(0) : 0;
+
+            bool avx2 = false, avx512 = false;
+
+            if (max >= 7)
+            {
+                __cpuidex(r, 7, 0);
+                avx2 = avx && (r[1] & (1 << 5)) && (xcr0 & 0x6) == 0x6;
+                avx512 = (r[1] & (1 << 16)) && (xcr0 & 0xe6) == 0xe6;
+            }
+#else
+            // libgcc also checks that the OS saves the wider register state.
+            //
+
+            __builtin_cpu_init();
+
+            bool sse41 = __builtin_cpu_supports("sse4.1");
+            bool avx2 = __builtin_cpu_supports("avx2");
+            bool avx512 = __builtin_cpu_supports("avx512f");
+#endif
+            if (avx512)
+                return Kernel::Avx512;
+            if (avx2)
+                return Kernel::Avx2;
+            if (sse41)
+                return Kernel::Sse41;
+#endif
+            return Kernel::Scalar;
+        }
+
+        inline std::atomic<Kernel>& Selected()
+        {
+            static std::atomic<Kernel> kernel(Detect());
+            return kernel;
+        }
+
+        inline Kernel Active()
+        {
+            return Selected().load(std::memory_order_relaxed);
+        }
+
+        // Pin a narrower kernel, for comparing paths on one host. Requests above what the CPU supports are clamped.
+        //
+
+        inline Kernel Select(Kernel k)
+        {
+            Kernel best = Detect();
+
+            if ((int)k > (int)best)
+                k = best;
+
+            Selected().store(k, std::memory_order_relaxed);
+
+            return k;
+        }
+    }
+}
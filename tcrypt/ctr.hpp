@@ -0,0 +1,136 @@
+/* Copyright (C) 2020 D8DATAWORKS - All Rights Reserved */
+
+#pragma once
+
+#include <algorithm>
+
+#include "block.hpp"
+#include "parallel.hpp"
+
+#include "d8u/buffer.hpp"
+
+namespace template_crypto
+{
+    namespace ctr
+    {
+        using namespace block;
+
+        // Counter mode over the encode function. Block i of the stream is masked with E(E(iv + i) ^ w),
+        // the counter being the iv bytes read as one little endian integer and w the key xor 0x36 in every byte.
+        // Every block is independent, so the stream can be entered at any block and cut into any number of pieces.
+        // Encryption and decryption are the same operation.
+        //
+        // E is linear over Z/2^w, so E(iv + i) alone would be E(iv) + i E(1) wherever the counter does not carry
+        // between words, and two known blocks of keystream would give away all the others.
+        // The xor between the two passes mixes bitwise and modular arithmetic the same way the chaining of the CBC
+        // mode does, the stream is the second block of a CBC encryption of (iv + i, w). It is no stronger than that mode.
+        //
+
+        template < typename INT, size_t block > class Long
+        {
+        public:
+
+            static constexpr size_t block_bytes() { return sizeof(INT) * block; }
+
+            constexpr Long(const std::array<INT, block>& _key, const std::array<INT, block>& _iv)
+                : ecl(_key)
+                , iv(_iv)
+            {
+                for (size_t j = 0; j < block; j++)
+                    whitening[j] = _key[j] ^ INT(INT(~INT(0)) / INT(0xff) * INT(0x36));
+            }
+
+            ~Long()
+            {
+                Wipe(ecl);
+                Wipe(iv);
+                Wipe(whitening);
+            }
+
+            template <typename T> void Crypt(T& _data, uint64_t block_offset = 0) const
+            {
+                auto data = d8u::byte_buffer(_data);
+
+                Crypt(data.data(), data.size(), block_offset);
+            }
+
+            template <typename T> void CryptParallel(T& _data, size_t threads = 0, size_t min_chunk = 1024 * 1024, uint64_t block_offset = 0) const
+            {
+                auto data = d8u::byte_buffer(_data);
+
+                size_t chunk = std::max(min_chunk / block_bytes(), size_t(1)) * block_bytes();
+                size_t chunks = (data.size() + chunk - 1) / chunk;
+
+                parallel::For(chunks, threads, [&](size_t c)
+                {
+                    size_t offset = c * chunk;
+
+                    Crypt(data.data() + offset, std::min(chunk, data.size() - offset), block_offset + offset / block_bytes());
+                });
+            }
+
+            void Crypt(uint8_t* data, size_t size, uint64_t block_offset) const
+            {
+                std::array<std::array<INT, block>, batch> counters;
+                std::array<std::array<INT, block>, batch> stream;
+
+                size_t blocks = (size + block_bytes() - 1) / block_bytes();
+
+                for (size_t i = 0; i < blocks; i += batch)
+                {
+                    size_t count = std::min(batch, blocks - i);
+
+                    for (size_t l = 0; l < count; l++)
+                        counters[l] = Counter(block_offset + i + l);
+
+                    ecl.Run(counters.data(), stream.data(), count);
+
+                    for (size_t l = 0; l < count; l++)
+                    {
+                        for (size_t j = 0; j < block; j++)
+                            stream[l][j] ^= whitening[j];
+                    }
+
+                    ecl.Run(stream.data(), counters.data(), count);
+
+                    size_t offset = i * block_bytes();
+                    size_t bytes = std::min(count * block_bytes(), size - offset);
+
+                    auto key_stream = (const uint8_t*)counters.data();
+
+                    for (size_t j = 0; j < bytes; j++)
+                        data[offset + j] ^= key_stream[j];
+                }
+
+                Wipe(counters);
+                Wipe(stream);
+            }
+
+        private:
+
+            static constexpr size_t batch = (block < large_block_threshold) ? 16 : 1;
+
+            std::array<INT, block> Counter(uint64_t index) const
+            {
+                std::array<INT, block> counter = iv;
+                auto bytes = (uint8_t*)counter.data();
+
+                unsigned carry = 0;
+
+                for (size_t j = 0; j < block_bytes() && (index || carry); j++, index >>= 8)
+                {
+                    carry += bytes[j] + unsigned(index & 0xff);
+                    bytes[j] = uint8_t(carry);
+                    carry >>= 8;
+                }
+
+                return counter;
+            }
+
+            EncodeContext<INT, block> ecl;
+
+            std::array<INT, block> iv;
+            std::array<INT, block> whitening = {};
+        };
+    }
+}
@@ -2,9 +2,12 @@
 
 #pragma once
 
-#include "block.hpp"
+#include <algorithm>
 
-#include "hash/polynomial.hpp"
+#include "block.hpp"
+#include "mac.hpp"
+#include "perf.hpp"
+#include "parallel.hpp"
 
 #include "d8u/buffer.hpp"
 
@@ -14,46 +17,373 @@ namespace template_crypto
     {
         using namespace block;
 
-        template < typename INT, size_t block > class Long
+        // steal must match the encrypt::Long that produced the ciphertext.
+        // As with encrypt::Long every method but the Stream ones is const and safe to call from several threads at once.
+        //
+
+        template < typename INT, size_t block, bool steal = false > class Long
         {
         public:
 
-            constexpr size_t block_bytes() { return sizeof(INT) * block; }
+            static constexpr size_t block_bytes() { return sizeof(INT) * block; }
 
             constexpr Long(const std::array<INT, block>& _key, const std::array<INT, block>& _iv)
                 : ecl(_key)
-                , iv(_iv) {}
+                , iv(_iv)
+            {
+                if constexpr (simd::gemm_shape<INT, block>())
+                    simd::TransposeFunction<INT, block>(ecl.Symmetry(), mt.data());
+            }
 
             ~Long()
             {
-                std::memset(this, 0, sizeof(this));
+                Wipe(ecl);
+                Wipe(iv);
+                Wipe(mt);
             }
 
-            template <typename T> void Decrypt(T& _data)
+            template <typename T> void Decrypt(T& _data) const
             {
                 auto data = d8u::byte_buffer(_data);
 
-                size_t blocks = data.size() / block_bytes();
-                size_t tail = data.size() % block_bytes();
+                Decrypt(data.data(), data.data(), data.size());
+            }
+
+            // Single pass from src to dst, src is left intact. dst must hold at least as many bytes as src.
+            //
+
+            template <typename S, typename D> void Decrypt(const S& _src, D& _dst) const
+            {
+                auto src = const_byte_buffer(_src);
+                auto dst = d8u::byte_buffer(_dst);
+
+                Expects(dst.size() >= src.size());
+
+                Decrypt(src.data(), dst.data(), src.size());
+            }
+
+            void Decrypt(const uint8_t* src, uint8_t* dst, size_t size) const
+            {
+                Decrypt(src, dst, size, iv);
+            }
+
+            // Same as above under another iv, for framings that give each message its own.
+            //
+
+            void Decrypt(const uint8_t* src, uint8_t* dst, size_t size, const std::array<INT, block>& message_iv) const
+            {
+                TCRYPT_PERF_SCOPE(DecryptLoop);
+
+                size_t blocks = size / block_bytes();
+                size_t tail = size % block_bytes();
+
+                bool stream = size >= simd::stream_threshold;
+
+                size_t held = (steal && tail && blocks) ? 1 : 0;
+                size_t whole = (blocks - held) * block_bytes();
+
+                auto _iv = Blocks(src, dst, blocks - held, message_iv, stream);
+
+                simd::Fence(stream);
+
+                Finish(src + whole, dst + whole, size - whole, _iv);
+            }
+
+            // Decrypt only length bytes starting at byte_offset of the ciphertext into out.
+            // Block i needs nothing but ciphertext blocks i - 1 and i, so only the covering blocks are touched.
+            // A range running past the end of the ciphertext is cut short, the number of bytes written is returned.
+            // out must hold the range after it is cut short.
+            //
+
+            template <typename S, typename D> size_t DecryptRange(const S& _ciphertext, size_t byte_offset, size_t length, D& _out) const
+            {
+                auto ciphertext = const_byte_buffer(_ciphertext);
+                auto out = d8u::byte_buffer(_out);
+
+                if (byte_offset < ciphertext.size())
+                    length = std::min(length, ciphertext.size() - byte_offset);
+
+                Expects(out.size() >= length);
+
+                return DecryptRange(ciphertext.data(), ciphertext.size(), byte_offset, length, out.data());
+            }
+
+            size_t DecryptRange(const uint8_t* ciphertext, size_t size, size_t byte_offset, size_t length, uint8_t* out) const
+            {
+                if (byte_offset >= size)
+                    return 0;
+
+                length = std::min(length, size - byte_offset);
+
+                if (!length)
+                    return 0;
+
+                TCRYPT_PERF_SCOPE(DecryptLoop);
+
+                size_t blocks = size / block_bytes();
+                size_t tail = size % block_bytes();
+
+                // With steal the last whole block can only be decoded together with the tail.
+                //
+
+                blocks -= (steal && tail && blocks) ? 1 : 0;
+
+                size_t first = std::min(byte_offset / block_bytes(), blocks);
+                size_t end = std::min((byte_offset + length + block_bytes() - 1) / block_bytes(), blocks);
 
-                std::array<INT, block>* block_p = (std::array<INT, block>*)data.data();
                 std::array<INT, block> _iv = iv;
 
-                for (size_t i = 0; i < blocks; i++, block_p++)
+                if (first)
                 {
-                    ecl.Run(*block_p, temp);
-                    *block_p = temp;
+                    std::array<INT, block> previous;
+                    std::memcpy(previous.data(), ciphertext + (first - 1) * block_bytes(), block_bytes());
 
-                    for (size_t i = 0; i < block; i++)
-                        (*block_p)[i] ^= _iv[i];
+                    ecl.Run(previous, _iv);
+                }
+
+                std::array<std::array<INT, block>, batch> plain;
+
+                for (size_t i = first; i < end; i += batch)
+                {
+                    size_t count = std::min(batch, end - i);
+
+                    _iv = Blocks(ciphertext + i * block_bytes(), (uint8_t*)plain.data(), count, _iv, false);
+
+                    Copy((const uint8_t*)plain.data(), i * block_bytes(), count * block_bytes(), byte_offset, length, out);
+                }
+
+                if (byte_offset + length > blocks * block_bytes())
+                {
+                    std::array<INT, 2 * block> tb;
+                    size_t rest = size - blocks * block_bytes();
+
+                    Finish(ciphertext + blocks * block_bytes(), (uint8_t*)tb.data(), rest, _iv);
+
+                    Copy((const uint8_t*)tb.data(), blocks * block_bytes(), rest, byte_offset, length, out);
+
+                    Wipe(tb);
+                }
+
+                Wipe(plain);
+
+                return length;
+            }
+
+            // Incremental form of Decrypt, the concatenated output of every Update and Finalize matches one Decrypt of the concatenated input.
+            // Whole blocks are emitted as soon as they are complete, a partial block waits for the next call.
+            // src and dst must not overlap.
+            //
+
+            class Stream
+            {
+            public:
+
+                Stream(const Long& _key)
+                    : key(_key)
+                    , _iv(_key.iv) {}
+
+                ~Stream()
+                {
+                    Wipe(_iv);
+                    Wipe(partial);
+                }
+
+                // dst must hold src.size() + block_bytes() - 1 bytes, or src.size() + 2 * block_bytes() - 1 with steal.
+                // Returns the bytes written.
+                //
+
+                template <typename S, typename D> size_t Update(const S& _src, D& _dst)
+                {
+                    auto src = const_byte_buffer(_src);
+                    auto dst = d8u::byte_buffer(_dst);
+
+                    return Update(src.data(), src.size(), dst.data());
+                }
+
+                size_t Update(const uint8_t* src, size_t size, uint8_t* dst)
+                {
+                    size_t total = pending + size;
+                    size_t keep = total % block_bytes() + ((steal && total >= block_bytes()) ? block_bytes() : 0);
+                    size_t written = 0;
+
+                    // Blocks already held go first, topped up from src when only part of one is held.
+                    //
+
+                    while (pending && written + keep < total)
+                    {
+                        if (pending < block_bytes())
+                        {
+                            size_t fill = block_bytes() - pending;
+
+                            std::memcpy((uint8_t*)partial.data() + pending, src, fill);
+                            pending += fill; src += fill; size -= fill;
+                        }
+
+                        _iv = key.Blocks((const uint8_t*)partial.data(), dst + written, 1, _iv, false);
+                        pending -= block_bytes(); written += block_bytes();
+
+                        std::memmove(partial.data(), (const uint8_t*)partial.data() + block_bytes(), pending);
+                    }
+
+                    size_t blocks = (total - keep - written) / block_bytes();
+
+                    _iv = key.Blocks(src, dst + written, blocks, _iv, false);
+                    written += blocks * block_bytes();
+                    src += blocks * block_bytes(); size -= blocks * block_bytes();
+
+                    std::memcpy((uint8_t*)partial.data() + pending, src, size);
+                    pending += size;
+
+                    return written;
+                }
+
+                // dst must hold block_bytes() - 1 bytes, or 2 * block_bytes() - 1 with steal. Returns the bytes written.
+                // The stream then starts over from the iv for the next message.
+                //
+
+                template <typename D> size_t Finalize(D& _dst)
+                {
+                    return Finalize(d8u::byte_buffer(_dst).data());
+                }
+
+                size_t Finalize(uint8_t* dst)
+                {
+                    size_t size = pending;
+
+                    key.Finish((const uint8_t*)partial.data(), dst, size, _iv);
+
+                    pending = 0;
+                    _iv = key.iv;
+
+                    return size;
+                }
+
+            private:
+                const Long& key;
+
+                std::array<INT, block> _iv;
+                std::array<INT, 2 * block> partial = {};
+                size_t pending = 0;
+            };
+
+            // Each chunk is seeded with the function of the last ciphertext block before it,
+            // the output is identical to Decrypt.
+            //
+
+            template <typename T> void DecryptParallel(T& _data, size_t threads = 0, size_t min_chunk = 1024 * 1024) const
+            {
+                auto data = d8u::byte_buffer(_data);
+
+                DecryptParallel(data.data(), data.data(), data.size(), threads, min_chunk);
+            }
+
+            template <typename T> void DecryptParallel(T& _data, parallel::Pool& pool, size_t min_chunk = 1024 * 1024) const
+            {
+                auto data = d8u::byte_buffer(_data);
+
+                DecryptChunks(data.data(), data.data(), data.size(), pool.size(), min_chunk, [&](size_t tasks, auto&& f) { pool.For(tasks, f); });
+            }
+
+            // From src to dst, which must not partially overlap.
+            //
+
+            void DecryptParallel(const uint8_t* src, uint8_t* dst, size_t size, size_t threads = 0, size_t min_chunk = 1024 * 1024) const
+            {
+                threads = parallel::Threads(threads);
+
+                DecryptChunks(src, dst, size, threads, min_chunk, [&](size_t tasks, auto&& f) { parallel::For(tasks, threads, f); });
+            }
+
+        private:
 
-                    _iv = temp;
+            template < typename, size_t, bool > friend class Authenticated;
+
+            static constexpr size_t batch = (block < large_block_threshold) ? 16 : 1;
+
+            template <typename MAC = mac::Discard> std::array<INT, block> Blocks(const uint8_t* src, uint8_t* dst, size_t blocks, std::array<INT, block> _iv, bool stream, MAC&& hash = MAC()) const
+            {
+                if constexpr (simd::gemm_shape<INT, block>())
+                {
+                    if (blocks * block_bytes() >= simd::gemm_threshold && simd::GemmKernel())
+                        return GemmBlocks(src, dst, blocks, _iv, stream, hash);
+                }
+
+                std::array<std::array<INT, block>, batch> in, lanes;
+
+                // The function of each block depends only on its ciphertext,
+                // so a batch runs side by side and the chaining is applied afterwards.
+                //
+
+                for (size_t i = 0; i < blocks; i += batch)
+                {
+                    size_t count = std::min(batch, blocks - i);
+
+                    std::memcpy(in.data(), src + i * block_bytes(), count * block_bytes());
+
+                    hash.Update((const uint8_t*)in.data(), count * block_bytes());
+
+                    ecl.Run(in.data(), lanes.data(), count);
+
+                    for (size_t l = 0; l < count; l++)
+                    {
+                        for (size_t j = 0; j < block; j++)
+                            in[l][j] = lanes[l][j] ^ _iv[j];
+
+                        _iv = lanes[l];
+                    }
+
+                    simd::Store(dst + i * block_bytes(), in.data(), count * block_bytes(), stream);
                 }
 
+                Wipe(in);
+
+                return _iv;
+            }
+
+            template <typename MAC> std::array<INT, block> GemmBlocks(const uint8_t* src, uint8_t* dst, size_t blocks, std::array<INT, block> _iv, bool stream, MAC&& hash) const
+            {
+                constexpr size_t chunk = std::max(size_t(1), simd::gemm_chunk / block_bytes());
+
+                std::array<std::array<INT, block>, chunk> lanes;
+
+                for (size_t i = 0; i < blocks; i += chunk)
+                {
+                    size_t count = std::min(chunk, blocks - i);
+
+                    hash.Update(src + i * block_bytes(), count * block_bytes());
+
+                    simd::FunctionGemm((const std::array<INT, block>*)(src + i * block_bytes()), lanes.data(), count, mt.data());
+
+                    // Chained back to front in place, the last function value seeds the next chunk.
+                    //
+
+                    auto next = lanes[count - 1];
+
+                    for (size_t l = count - 1; l > 0; l--)
+                    {
+                        for (size_t j = 0; j < block; j++)
+                            lanes[l][j] ^= lanes[l - 1][j];
+                    }
+
+                    for (size_t j = 0; j < block; j++)
+                        lanes[0][j] ^= _iv[j];
+
+                    _iv = next;
+
+                    simd::Store(dst + i * block_bytes(), lanes.data(), count * block_bytes(), stream);
+                }
+
+                Wipe(lanes);
+
+                return _iv;
+            }
+
+            void Tail(uint8_t* data, size_t tail, const std::array<INT, block>& _iv) const
+            {
                 if (tail)
                 {
                     std::array<INT, block> tb = {};
-                    std::memcpy(&tb, data.data() + blocks * block_bytes(), tail);
+                    std::memcpy(&tb, data, tail);
 
                     // For now the tail is only masked
                     // More research is being done into this. See encrypt.hpp
@@ -64,16 +394,190 @@ namespace template_crypto
 
                     //Block(gsl::span<INT>(tb.data(), block), gsl::span<INT>(_iv.data(), block));
 
-                    std::memcpy(data.data() + blocks * block_bytes(), &tb, tail);
+                    std::memcpy(data, &tb, tail);
                 }
             }
 
-        private:
+            void Steal(uint8_t* data, size_t tail, const std::array<INT, block>& _iv) const
+            {
+                // Inverse of encrypt::Steal. The whole block slot decodes to the masked tail and the end of the stolen ciphertext,
+                // which together with the tail slot rebuilds the last whole ciphertext block.
+                //
+
+                std::array<INT, block> cn, y, c, x;
+
+                std::memcpy(cn.data(), data, block_bytes());
+
+                ecl.Run(cn, y);
+
+                auto yb = (const uint8_t*)y.data();
+                auto cb = (uint8_t*)c.data();
+                auto xb = (const uint8_t*)x.data();
+
+                std::memcpy(cb, data + block_bytes(), tail);
+                std::memcpy(cb + tail, yb + tail, block_bytes() - tail);
+
+                ecl.Run(c, x);
+
+                for (size_t i = 0; i < tail; i++)
+                    data[block_bytes() + i] = yb[i] ^ xb[i];
+
+                for (size_t i = 0; i < block; i++)
+                    c[i] = x[i] ^ _iv[i];
+
+                std::memcpy(data, c.data(), block_bytes());
+
+                Wipe(y);
+                Wipe(c);
+                Wipe(x);
+            }
+
+            void Finish(const uint8_t* src, uint8_t* dst, size_t size, const std::array<INT, block>& _iv) const
+            {
+                // What follows the whole blocks, a tail shorter than a block or with steal the last block and its tail.
+                //
+
+                if (src != dst)
+                    std::memcpy(dst, src, size);
+
+                if (size > block_bytes())
+                    Steal(dst, size - block_bytes(), _iv);
+                else if (size == block_bytes())
+                    Blocks(dst, dst, 1, _iv, false);
+                else
+                    Tail(dst, size, _iv);
+            }
+
+            static void Copy(const uint8_t* plain, size_t position, size_t size, size_t byte_offset, size_t length, uint8_t* out)
+            {
+                // Copy the part of [position, position + size) that falls inside the requested range.
+                //
+
+                size_t begin = std::max(position, byte_offset);
+                size_t end = std::min(position + size, byte_offset + length);
+
+                if (begin < end)
+                    std::memcpy(out + begin - byte_offset, plain + begin - position, end - begin);
+            }
+
+            template <typename EXEC> void DecryptChunks(const uint8_t* src, uint8_t* dst, size_t size, size_t threads, size_t min_chunk, EXEC&& exec) const
+            {
+                size_t blocks = size / block_bytes();
+                size_t tail = size % block_bytes();
+
+                blocks -= (steal && tail && blocks) ? 1 : 0;
+
+                auto block_p = (const std::array<INT, block>*)src;
+
+                // A few chunks per thread keeps the workers busy when some run slower.
+                //
+
+                size_t chunk = std::max({ min_chunk / block_bytes(), blocks / (4 * threads), size_t(1) });
+                size_t chunks = (blocks + chunk - 1) / chunk;
+
+                // In place, chunks overwrite their own last block, so the seeds are taken before any of them run.
+                //
+
+                std::vector<std::array<INT, block>> seeds(chunks + 1);
+
+                seeds[0] = iv;
+
+                for (size_t c = 1; c < chunks + 1; c++)
+                    ecl.Run(block_p[std::min(c * chunk, blocks) - 1], seeds[c]);
+
+                exec(chunks, [&](size_t c)
+                {
+                    TCRYPT_PERF_SCOPE(DecryptLoop);
+
+                    size_t offset = c * chunk * block_bytes();
+
+                    Blocks(src + offset, dst + offset, std::min(chunk, blocks - c * chunk), seeds[c], false);
+                });
+
+                Finish(src + blocks * block_bytes(), dst + blocks * block_bytes(), size - blocks * block_bytes(), seeds[chunks]);
+
+                for (auto& seed : seeds)
+                    Wipe(seed);
+            }
 
             DecodeContextShort<INT, block> ecl;
 
             std::array<INT, block> iv;
-            std::array<INT, block> temp;
+
+            // The symmetry transposed for GemmBlocks, built with the schedule. Empty for shapes that never take the GEMM path.
+            //
+
+            std::array<INT, simd::gemm_shape<INT, block>() ? block * block : 0> mt = {};
+        };
+
+        // Verifies the tag of encrypt::Authenticated in the same pass that decodes the ciphertext.
+        // On a mismatch dst is wiped, so unauthenticated plaintext is never handed out.
+        //
+
+        template < typename INT, size_t block, bool steal = false > class Authenticated
+        {
+        public:
+
+            static constexpr size_t block_bytes() { return sizeof(INT) * block; }
+
+            Authenticated(const std::array<INT, block>& _key, const std::array<INT, block>& _iv)
+                : cipher(_key, _iv)
+                , authenticator(_key) {}
+
+            template <typename T> bool Decrypt(T& _data, const mac::Tag& tag) const
+            {
+                auto data = d8u::byte_buffer(_data);
+
+                return Decrypt(data.data(), data.data(), data.size(), tag);
+            }
+
+            template <typename S, typename D> bool Decrypt(const S& _src, D& _dst, const mac::Tag& tag) const
+            {
+                auto src = const_byte_buffer(_src);
+                auto dst = d8u::byte_buffer(_dst);
+
+                Expects(dst.size() >= src.size());
+
+                return Decrypt(src.data(), dst.data(), src.size(), tag);
+            }
+
+            bool Decrypt(const uint8_t* src, uint8_t* dst, size_t size, const mac::Tag& tag) const
+            {
+                TCRYPT_PERF_SCOPE(DecryptLoop);
+
+                size_t blocks = size / block_bytes();
+                size_t tail = size % block_bytes();
+
+                size_t held = (steal && tail && blocks) ? 1 : 0;
+                size_t whole = (blocks - held) * block_bytes();
+
+                // Written through the cache, non temporal stores measured slower here as the hash keeps the core busy.
+                //
+
+                auto hash = authenticator.Hash();
+                auto _iv = cipher.Blocks(src, dst, blocks - held, cipher.iv, false, hash);
+
+                // Hashed before Finish, which may overwrite it in place.
+                //
+
+                hash.Update(src + whole, size - whole);
+                cipher.Finish(src + whole, dst + whole, size - whole, _iv);
+
+                Wipe(_iv);
+
+                bool valid = mac::Key<INT, block>::Equal(authenticator.Seal(hash, size, cipher.iv), tag);
+
+                if (!valid && size)
+                    std::memset(dst, 0, size);
+
+                return valid;
+            }
+
+        private:
+
+            Long<INT, block, steal> cipher;
+
+            mac::Key<INT, block> authenticator;
         };
     }
 }
\ No newline at end of file
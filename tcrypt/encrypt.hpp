@@ -2,7 +2,11 @@
 
 #pragma once
 
+#include <algorithm>
+
 #include "block.hpp"
+#include "mac.hpp"
+#include "perf.hpp"
 
 #include "d8u/buffer.hpp"
 
@@ -12,11 +16,78 @@ namespace template_crypto
     {
         using namespace block;
 
-        template < typename INT, size_t block > class Long
+        template < typename INT, size_t block > void Tail(uint8_t* data, size_t tail, const std::array<INT, block>& _iv)
+        {
+            if (tail)
+            {
+                std::array<INT, block> tb = {};
+                std::memcpy(&tb, data, tail);
+
+                // It is tricky to execute the function for a unit that is not the block size.
+                // Also doing so might reveal a weakened state.
+                // For now execute the masking only.
+                // Messages of at least one whole block can use Steal instead.
+                //
+
+                for (size_t i = 0; i < block; i++)
+                    tb[i] ^= _iv[i];
+
+                //Block(gsl::span<INT>(tb.data(), block), gsl::span<INT>(_iv.data(), block));
+
+                std::memcpy(data, &tb, tail);
+            }
+        }
+
+        template < typename INT, size_t block, typename CTX > void Steal(uint8_t* data, size_t tail, const std::array<INT, block>& _iv, const CTX& ecl)
+        {
+            // Ciphertext stealing, data holds the last whole block followed by a tail of 1 to block_bytes - 1 bytes.
+            // The whole block is encrypted as usual. The tail is masked with that block's chained state,
+            // completed with the end of its ciphertext and encrypted in turn.
+            // The second ciphertext takes the whole block slot and the head of the first takes the tail slot,
+            // so every byte passes through the function and nothing grows.
+            //
+
+            constexpr size_t block_bytes = sizeof(INT) * block;
+
+            std::array<INT, block> x, c, y, cn;
+
+            std::memcpy(x.data(), data, block_bytes);
+
+            for (size_t i = 0; i < block; i++)
+                x[i] ^= _iv[i];
+
+            ecl.Run(&x, &c, 1);
+
+            auto xb = (const uint8_t*)x.data();
+            auto cb = (const uint8_t*)c.data();
+            auto yb = (uint8_t*)y.data();
+
+            for (size_t i = 0; i < tail; i++)
+                yb[i] = data[block_bytes + i] ^ xb[i];
+
+            std::memcpy(yb + tail, cb + tail, block_bytes - tail);
+
+            ecl.Run(&y, &cn, 1);
+
+            std::memcpy(data, cn.data(), block_bytes);
+            std::memcpy(data + block_bytes, cb, tail);
+
+            Wipe(x);
+            Wipe(y);
+        }
+
+        // With steal set a message of at least one whole block ends in ciphertext stealing instead of the masked tail.
+        // Shorter messages have no block to steal from and keep the mask.
+        //
+        // The expanded key is never written after construction and every call keeps its chaining state on its own stack,
+        // so one Long may serve any number of threads at once. Stream holds the per message state and is per thread.
+        //
+
+        template < typename INT, size_t block, bool steal = false > class Long
         {
         public:
 
-            constexpr size_t block_bytes() { return sizeof(INT) * block; }
+            static constexpr size_t block_bytes() { return sizeof(INT) * block; }
 
             constexpr Long(const std::array<INT, block>& _key, const std::array<INT, block>& _iv)
                 : ecl(_key)
@@ -24,57 +95,392 @@ namespace template_crypto
 
             ~Long()
             {
-                std::memset(this,0,sizeof(this));
+                Wipe(ecl);
+                Wipe(iv);
             }
 
-            template <typename T> void Encrypt(T & _data)
+            template <typename T> void Encrypt(T & _data) const
             {
                 auto data = d8u::byte_buffer(_data);
 
-                size_t blocks = data.size() / block_bytes();
-                size_t tail = data.size() % block_bytes();
+                Encrypt(data.data(), data.data(), data.size());
+            }
+
+            // Single pass from src to dst, src is left intact. dst must hold at least as many bytes as src.
+            //
+
+            template <typename S, typename D> void Encrypt(const S& _src, D& _dst) const
+            {
+                auto src = const_byte_buffer(_src);
+                auto dst = d8u::byte_buffer(_dst);
+
+                Expects(dst.size() >= src.size());
+
+                Encrypt(src.data(), dst.data(), src.size());
+            }
+
+            void Encrypt(const uint8_t* src, uint8_t* dst, size_t size) const
+            {
+                Encrypt(src, dst, size, iv);
+            }
+
+            // Same as above under another iv, for framings that give each message its own.
+            //
+
+            void Encrypt(const uint8_t* src, uint8_t* dst, size_t size, const std::array<INT, block>& message_iv) const
+            {
+                TCRYPT_PERF_SCOPE(EncryptLoop);
+
+                size_t blocks = size / block_bytes();
+                size_t tail = size % block_bytes();
+
+                bool stream = size >= simd::stream_threshold;
+
+                size_t held = (steal && tail && blocks) ? 1 : 0;
+                size_t whole = (blocks - held) * block_bytes();
+
+                auto _iv = Blocks(src, dst, blocks - held, message_iv, stream);
+
+                simd::Fence(stream);
 
-                std::array<INT, block>* block_p = (std::array<INT, block>*)data.data();
-                std::array<INT, block> _iv = iv;
+                Finish(src + whole, dst + whole, size - whole, _iv);
 
-                for (size_t i = 0; i < blocks; i++,block_p++)
+                Wipe(_iv);
+            }
+
+            // Incremental form of Encrypt, the concatenated output of every Update and Finalize matches one Encrypt of the concatenated input.
+            // Whole blocks are emitted as soon as they are complete, a partial block waits for the next call.
+            // With steal the last whole block also waits, as its slot depends on the tail.
+            // src and dst must not overlap.
+            //
+
+            class Stream
+            {
+            public:
+
+                Stream(const Long& _key)
+                    : key(_key)
+                    , _iv(_key.iv) {}
+
+                ~Stream()
                 {
-                    for (size_t j = 0; j < block; j++)
-                        (*block_p)[j] ^= _iv[j];
+                    Wipe(_iv);
+                    Wipe(partial);
+                }
 
-                    _iv = *block_p;
+                // dst must hold src.size() + block_bytes() - 1 bytes, or src.size() + 2 * block_bytes() - 1 with steal.
+                // Returns the bytes written.
+                //
 
-                    ecl.Run(*block_p, temp, *block_p);
+                template <typename S, typename D> size_t Update(const S& _src, D& _dst)
+                {
+                    auto src = const_byte_buffer(_src);
+                    auto dst = d8u::byte_buffer(_dst);
+
+                    return Update(src.data(), src.size(), dst.data());
                 }
 
-                if (tail)
+                size_t Update(const uint8_t* src, size_t size, uint8_t* dst)
                 {
-                    std::array<INT, block> tb = {};
-                    std::memcpy(&tb, data.data() + blocks * block_bytes(), tail);
+                    size_t total = pending + size;
+                    size_t keep = total % block_bytes() + ((steal && total >= block_bytes()) ? block_bytes() : 0);
+                    size_t written = 0;
 
-                    // It is tricky to execute the function for a unit that is not the block size.
-                    // Also doing so might reveal a weakened state.
-                    // For now execute the masking only.
-                    // Todo revisit the tail block.
+                    // Blocks already held go first, topped up from src when only part of one is held.
                     //
 
-                    for (size_t i = 0; i < block; i++)
-                        tb[i] ^= _iv[i];
+                    while (pending && written + keep < total)
+                    {
+                        if (pending < block_bytes())
+                        {
+                            size_t fill = block_bytes() - pending;
+
+                            std::memcpy((uint8_t*)partial.data() + pending, src, fill);
+                            pending += fill; src += fill; size -= fill;
+                        }
 
-                    //Block(gsl::span<INT>(tb.data(), block), gsl::span<INT>(_iv.data(), block));
+                        _iv = key.Blocks((const uint8_t*)partial.data(), dst + written, 1, _iv, false);
+                        pending -= block_bytes(); written += block_bytes();
 
-                    std::memcpy(data.data() + blocks * block_bytes(), &tb, tail);
+                        std::memmove(partial.data(), (const uint8_t*)partial.data() + block_bytes(), pending);
+                    }
+
+                    size_t blocks = (total - keep - written) / block_bytes();
+
+                    _iv = key.Blocks(src, dst + written, blocks, _iv, false);
+                    written += blocks * block_bytes();
+                    src += blocks * block_bytes(); size -= blocks * block_bytes();
+
+                    std::memcpy((uint8_t*)partial.data() + pending, src, size);
+                    pending += size;
+
+                    return written;
                 }
 
-                std::memset(_iv.data(), 0, block_bytes());
-            }
+                // dst must hold block_bytes() - 1 bytes, or 2 * block_bytes() - 1 with steal. Returns the bytes written.
+                // The stream then starts over from the iv for the next message.
+                //
+
+                template <typename D> size_t Finalize(D& _dst)
+                {
+                    return Finalize(d8u::byte_buffer(_dst).data());
+                }
+
+                size_t Finalize(uint8_t* dst)
+                {
+                    size_t size = pending;
+
+                    key.Finish((const uint8_t*)partial.data(), dst, size, _iv);
+
+                    pending = 0;
+                    _iv = key.iv;
+
+                    return size;
+                }
+
+            private:
+                const Long& key;
+
+                std::array<INT, block> _iv;
+                std::array<INT, 2 * block> partial = {};
+                size_t pending = 0;
+            };
 
         private:
 
-            EncodeContextLong2<INT,block> ecl;
+            template < typename, size_t, bool > friend class Authenticated;
+
+            static constexpr size_t batch = (block < large_block_threshold) ? 16 : 1;
+
+            template <typename MAC = mac::Discard> std::array<INT, block> Blocks(const uint8_t* src, uint8_t* dst, size_t blocks, std::array<INT, block> _iv, bool stream, MAC&& hash = MAC()) const
+            {
+                std::array<std::array<INT, block>, batch> in, out;
+
+                // The chaining only touches the plaintext side of the function,
+                // so a batch is masked first and then transformed side by side.
+                //
+
+                for (size_t i = 0; i < blocks; i += batch)
+                {
+                    size_t count = std::min(batch, blocks - i);
+
+                    std::memcpy(in.data(), src + i * block_bytes(), count * block_bytes());
+
+                    for (size_t l = 0; l < count; l++)
+                    {
+                        for (size_t j = 0; j < block; j++)
+                            in[l][j] ^= _iv[j];
+
+                        _iv = in[l];
+                    }
+
+                    ecl.Run(in.data(), out.data(), count);
+
+                    simd::Store(dst + i * block_bytes(), out.data(), count * block_bytes(), stream);
+
+                    hash.Update((const uint8_t*)out.data(), count * block_bytes());
+                }
+
+                Wipe(in);
+
+                return _iv;
+            }
+
+            void Finish(const uint8_t* src, uint8_t* dst, size_t size, const std::array<INT, block>& _iv) const
+            {
+                // What follows the whole blocks, a tail shorter than a block or with steal the last block and its tail.
+                //
+
+                if (src != dst)
+                    std::memcpy(dst, src, size);
+
+                if (size > block_bytes())
+                    Steal(dst, size - block_bytes(), _iv, ecl);
+                else if (size == block_bytes())
+                    Blocks(dst, dst, 1, _iv, false);
+                else
+                    Tail(dst, size, _iv);
+            }
+
+            EncodeContext<INT,block> ecl;
 
             std::array<INT, block> iv;
-            std::array<INT, block> temp;
+        };
+
+        // Encrypt then MAC in a single pass, each batch of ciphertext is hashed while it is still in cache.
+        // The tag covers the ciphertext, its length and the iv, see mac::Key.
+        // The hash state lives on the stack of each call, so one instance is safe to share between threads.
+        //
+
+        template < typename INT, size_t block, bool steal = false > class Authenticated
+        {
+        public:
+
+            static constexpr size_t block_bytes() { return sizeof(INT) * block; }
+
+            Authenticated(const std::array<INT, block>& _key, const std::array<INT, block>& _iv)
+                : cipher(_key, _iv)
+                , authenticator(_key) {}
+
+            template <typename T> mac::Tag Encrypt(T& _data) const
+            {
+                auto data = d8u::byte_buffer(_data);
+
+                return Encrypt(data.data(), data.data(), data.size());
+            }
+
+            template <typename S, typename D> mac::Tag Encrypt(const S& _src, D& _dst) const
+            {
+                auto src = const_byte_buffer(_src);
+                auto dst = d8u::byte_buffer(_dst);
+
+                Expects(dst.size() >= src.size());
+
+                return Encrypt(src.data(), dst.data(), src.size());
+            }
+
+            mac::Tag Encrypt(const uint8_t* src, uint8_t* dst, size_t size) const
+            {
+                TCRYPT_PERF_SCOPE(EncryptLoop);
+
+                size_t blocks = size / block_bytes();
+                size_t tail = size % block_bytes();
+
+                size_t held = (steal && tail && blocks) ? 1 : 0;
+                size_t whole = (blocks - held) * block_bytes();
+
+                // Written through the cache, non temporal stores measured slower here as the hash keeps the core busy.
+                //
+
+                auto hash = authenticator.Hash();
+                auto _iv = cipher.Blocks(src, dst, blocks - held, cipher.iv, false, hash);
+
+                cipher.Finish(src + whole, dst + whole, size - whole, _iv);
+                hash.Update(dst + whole, size - whole);
+
+                Wipe(_iv);
+
+                return authenticator.Seal(hash, size, cipher.iv);
+            }
+
+        private:
+
+            Long<INT, block, steal> cipher;
+
+            mac::Key<INT, block> authenticator;
+        };
+
+        // Many independent streams under one key, each with its own iv.
+        // Every step advances one block of each active stream side by side in the SIMD lanes,
+        // a stream that runs out of blocks retires its lane and the next waiting stream takes it.
+        // Each stream comes out exactly as Long would encrypt it.
+        //
+
+        template < typename INT, size_t block, size_t lanes = 16, bool steal = false > class MultiBuffer
+        {
+        public:
+
+            static constexpr size_t block_bytes() { return sizeof(INT) * block; }
+
+            constexpr MultiBuffer(const std::array<INT, block>& _key)
+                : ecl(_key) {}
+
+            ~MultiBuffer()
+            {
+                Wipe(ecl);
+            }
+
+            template <typename S, typename IV> void Encrypt(S& streams, const IV& ivs) const
+            {
+                std::array<Slot, lanes> slots;
+                std::array<std::array<INT, block>, lanes> in;
+                std::array<std::array<INT, block>, lanes> out;
+
+                size_t waiting = 0, active = 0;
+
+                auto refill = [&]()
+                {
+                    while (active < lanes && waiting < streams.size())
+                    {
+                        auto data = d8u::byte_buffer(streams[waiting]);
+
+                        size_t blocks = data.size() / block_bytes();
+                        size_t held = (steal && data.size() % block_bytes() && blocks) ? 1 : 0;
+
+                        Slot slot{ (std::array<INT, block>*)data.data(), blocks - held, data.data() + (blocks - held) * block_bytes(), data.size() - (blocks - held) * block_bytes(), ivs[waiting] };
+                        waiting++;
+
+                        if (slot.blocks)
+                            slots[active++] = slot;
+                        else
+                            Retire(slot);
+                    }
+                };
+
+                refill();
+
+                while (active)
+                {
+                    for (size_t l = 0; l < active; l++)
+                    {
+                        auto& slot = slots[l];
+
+                        for (size_t j = 0; j < block; j++)
+                            in[l][j] = (*slot.block_p)[j] ^ slot.iv[j];
+
+                        slot.iv = in[l];
+                    }
+
+                    ecl.Run(in.data(), out.data(), active);
+
+                    for (size_t l = 0; l < active;)
+                    {
+                        auto& slot = slots[l];
+
+                        *slot.block_p++ = out[l];
+
+                        if (--slot.blocks)
+                        {
+                            l++;
+                            continue;
+                        }
+
+                        // Keep the active lanes packed at the front, the order of lanes is irrelevant.
+                        //
+
+                        Retire(slot);
+                        slots[l] = slots[--active];
+                        std::swap(out[l], out[active]);
+                    }
+
+                    refill();
+                }
+
+                Wipe(in);
+            }
+
+        private:
+
+            struct Slot
+            {
+                std::array<INT, block>* block_p;
+                size_t blocks;
+                uint8_t* tail_p;
+                size_t tail;
+                std::array<INT, block> iv;
+            };
+
+            void Retire(Slot& slot) const
+            {
+                if (slot.tail > block_bytes())
+                    Steal(slot.tail_p, slot.tail - block_bytes(), slot.iv, ecl);
+                else
+                    Tail(slot.tail_p, slot.tail, slot.iv);
+
+                Wipe(slot.iv);
+            }
+
+            EncodeContext<INT, block> ecl;
         };
     }
 }
\ No newline at end of file
@@ -0,0 +1,253 @@
+/* Copyright (C) 2020 D8DATAWORKS - All Rights Reserved */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+#include "block.hpp"
+
+namespace template_crypto
+{
+    namespace mac
+    {
+        using namespace block;
+
+        // Polynomial hash over the Mersenne prime 2^61 - 1.
+        // The message is read as 32 bit limbs m_i and hashed as sum m_i r^(k - i), the length is the last limb.
+        // Eight limbs are folded per step with precomputed powers of r, so the multiplies do not wait on each other.
+        //
+
+        constexpr uint64_t prime = (uint64_t(1) << 61) - 1;
+
+        inline uint64_t Fold(uint64_t a)
+        {
+            return (a & prime) + (a >> 61);
+        }
+
+        inline uint64_t Multiply(uint64_t a, uint64_t b)
+        {
+            // a < 2^64 - 2^62 and b < 2^61, the result is below 2^62 but not fully reduced.
+            // The eight limb step passes a state of four folds plus a limb, just over 2^63, so a may exceed 2^63.
+            //
+
+#if defined(_MSC_VER) && !defined(__clang__)
+            uint64_t high, low = _umul128(a, b, &high);
+#else
+            unsigned __int128 product = (unsigned __int128)a * b;
+            uint64_t high = uint64_t(product >> 64), low = uint64_t(product);
+#endif
+            return Fold((low & prime) + ((high << 3) | (low >> 61)));
+        }
+
+        inline uint64_t Reduce(uint64_t a)
+        {
+            a = Fold(a);
+
+            return (a >= prime) ? a - prime : a;
+        }
+
+        class Polynomial
+        {
+        public:
+
+            Polynomial(uint64_t _r)
+            {
+                r[0] = Reduce(_r);
+
+                for (size_t i = 1; i < r.size(); i++)
+                    r[i] = Reduce(Multiply(r[i - 1], r[0]));
+            }
+
+            ~Polynomial()
+            {
+                Wipe(r);
+                Wipe(h);
+                Wipe(partial);
+            }
+
+            void Update(const uint8_t* data, size_t size)
+            {
+                if (pending)
+                {
+                    size_t fill = std::min(sizeof(partial) - pending, size);
+
+                    std::memcpy(partial + pending, data, fill);
+                    pending += fill; data += fill; size -= fill;
+
+                    if (pending < sizeof(partial))
+                        return;
+
+                    Limb(Load(partial));
+                    pending = 0;
+                }
+
+                // The state is kept local, byte stores through data could otherwise alias it.
+                //
+
+                uint64_t _h = h;
+                const auto _r = r;
+
+                for (; size >= 32; data += 32, size -= 32)
+                {
+                    _h = Fold(Multiply(_h + Load(data), _r[7]) + Multiply(Load(data + 4), _r[6]))
+                        + Fold(Multiply(Load(data + 8), _r[5]) + Multiply(Load(data + 12), _r[4]))
+                        + Fold(Multiply(Load(data + 16), _r[3]) + Multiply(Load(data + 20), _r[2]))
+                        + Fold(Multiply(Load(data + 24), _r[1]) + Multiply(Load(data + 28), _r[0]));
+                }
+
+                h = _h;
+
+                for (; size >= 4; data += 4, size -= 4)
+                    Limb(Load(data));
+
+                if (size)
+                    std::memcpy(partial, data, size);
+
+                pending = size;
+            }
+
+            // The partial limb is zero padded, the length that follows keeps padded messages apart.
+            //
+
+            uint64_t Finalize(uint64_t length)
+            {
+                if (pending)
+                {
+                    std::memset(partial + pending, 0, sizeof(partial) - pending);
+                    Limb(Load(partial));
+                }
+
+                Limb(length & 0xffffffff);
+                Limb(length >> 32);
+
+                return Reduce(h);
+            }
+
+        private:
+
+            static uint64_t Load(const uint8_t* data)
+            {
+                uint32_t limb;
+                std::memcpy(&limb, data, sizeof(limb));
+
+                return limb;
+            }
+
+            void Limb(uint64_t m)
+            {
+                h = Multiply(h + m, r[0]);
+            }
+
+            std::array<uint64_t, 8> r;
+            uint64_t h = 0;
+
+            uint8_t partial[4] = {};
+            size_t pending = 0;
+        };
+
+        // Nothing to hash, the plain modes pass this through the shared block loops.
+        //
+
+        struct Discard
+        {
+            void Update(const uint8_t*, size_t) {}
+        };
+
+        constexpr size_t tag_bytes = 16;
+
+        using Tag = std::array<uint8_t, tag_bytes>;
+
+        // The hash key and the tag function come from a second context under the key xor 0x5c..,
+        // so the encryption under the key never exposes either of them.
+        // The tag is the encoded block of iv xor hash and length, blocks smaller than a tag leave the rest zero.
+        //
+
+        template < typename INT, size_t block > class Key
+        {
+        public:
+
+            static constexpr size_t block_bytes() { return sizeof(INT) * block; }
+
+            Key(const std::array<INT, block>& _key)
+                : ecl(Derive(_key))
+            {
+                std::array<INT, block> seed, out;
+                std::memset(seed.data(), 0x36, block_bytes());
+
+                ecl.Run(&seed, &out, 1);
+
+                r = 0;
+                std::memcpy(&r, out.data(), std::min(sizeof(r), block_bytes()));
+
+                Wipe(out);
+            }
+
+            ~Key()
+            {
+                Wipe(ecl);
+                Wipe(r);
+            }
+
+            Polynomial Hash() const
+            {
+                return Polynomial(r);
+            }
+
+            Tag Seal(Polynomial& hash, uint64_t length, const std::array<INT, block>& iv) const
+            {
+                uint64_t words[2] = { hash.Finalize(length), length };
+
+                std::array<INT, block> in = iv, out;
+                auto bytes = (uint8_t*)in.data();
+
+                for (size_t i = 0; i < sizeof(words); i++)
+                    bytes[i % block_bytes()] ^= ((const uint8_t*)words)[i];
+
+                ecl.Run(&in, &out, 1);
+
+                Tag tag = {};
+                std::memcpy(tag.data(), out.data(), std::min(tag_bytes, block_bytes()));
+
+                Wipe(out);
+
+                return tag;
+            }
+
+            static bool Equal(const Tag& a, const Tag& b)
+            {
+                // Constant time, a forger learns nothing from how long the comparison took.
+                //
+
+                uint8_t difference = 0;
+
+                for (size_t i = 0; i < tag_bytes; i++)
+                    difference |= a[i] ^ b[i];
+
+                return difference == 0;
+            }
+
+        private:
+
+            static std::array<INT, block> Derive(std::array<INT, block> _key)
+            {
+                auto bytes = (uint8_t*)_key.data();
+
+                for (size_t i = 0; i < block_bytes(); i++)
+                    bytes[i] ^= 0x5c;
+
+                return _key;
+            }
+
+            EncodeContext<INT, block> ecl;
+
+            uint64_t r;
+        };
+    }
+}
@@ -0,0 +1,204 @@
+/* Copyright (C) 2020 D8DATAWORKS - All Rights Reserved */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "../gsl-lite.hpp"
+
+namespace template_crypto
+{
+    namespace mapped
+    {
+        // A whole file mapped into memory, so the ciphers run straight over the page cache
+        // instead of over a copy read into a buffer and written back.
+        // Empty files map to an empty span.
+        //
+
+        class File
+        {
+        public:
+
+            File() = default;
+
+            File(const File&) = delete;
+            File& operator=(const File&) = delete;
+
+            ~File()
+            {
+                Close();
+            }
+
+            // Map an existing file, read only unless writable.
+            //
+
+            bool Open(const char* path, bool writable)
+            {
+                Close();
+
+#if defined(_WIN32)
+                file = CreateFileA(path, writable ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+                if (file == INVALID_HANDLE_VALUE)
+                    return false;
+
+                LARGE_INTEGER length;
+
+                if (!GetFileSizeEx(file, &length))
+                    return false;
+
+                return Map((size_t)length.QuadPart, writable);
+#else
+                fd = open(path, writable ? O_RDWR : O_RDONLY);
+
+                if (fd < 0)
+                    return false;
+
+                struct stat info;
+
+                if (fstat(fd, &info) != 0)
+                    return false;
+
+                return Map((size_t)info.st_size, writable);
+#endif
+            }
+
+            // Create or truncate a file of length bytes and map it writable.
+            //
+
+            bool Create(const char* path, size_t length)
+            {
+                Close();
+
+#if defined(_WIN32)
+                file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+                if (file == INVALID_HANDLE_VALUE)
+                    return false;
+
+                LARGE_INTEGER end;
+                end.QuadPart = (LONGLONG)length;
+
+                if (!SetFilePointerEx(file, end, nullptr, FILE_BEGIN) || !SetEndOfFile(file))
+                    return false;
+#else
+                fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+                if (fd < 0 || ftruncate(fd, (off_t)length) != 0)
+                    return false;
+#endif
+                return Map(length, true);
+            }
+
+            // Whole file passes read front to back, so ask for aggressive read ahead and large pages where the kernel offers them.
+            //
+
+            void Sequential()
+            {
+#if !defined(_WIN32)
+                if (!length)
+                    return;
+
+                madvise(base, length, MADV_SEQUENTIAL);
+#if defined(MADV_HUGEPAGE)
+                madvise(base, length, MADV_HUGEPAGE);
+#endif
+#endif
+            }
+
+            bool Flush()
+            {
+                if (!length)
+                    return true;
+
+#if defined(_WIN32)
+                return FlushViewOfFile(base, 0) && FlushFileBuffers(file);
+#else
+                return msync(base, length, MS_SYNC) == 0;
+#endif
+            }
+
+            void Close()
+            {
+#if defined(_WIN32)
+                if (base)
+                    UnmapViewOfFile(base);
+                if (mapping)
+                    CloseHandle(mapping);
+                if (file != INVALID_HANDLE_VALUE)
+                    CloseHandle(file);
+
+                mapping = nullptr;
+                file = INVALID_HANDLE_VALUE;
+#else
+                if (base)
+                    munmap(base, length);
+                if (fd >= 0)
+                    close(fd);
+
+                fd = -1;
+#endif
+                base = nullptr;
+                length = 0;
+            }
+
+            uint8_t* data() { return (uint8_t*)base; }
+            const uint8_t* data() const { return (const uint8_t*)base; }
+
+            size_t size() const { return length; }
+
+            gsl::span<uint8_t> span() { return gsl::span<uint8_t>(data(), length); }
+
+        private:
+
+            bool Map(size_t _length, bool writable)
+            {
+                if (!_length)
+                    return true;
+
+#if defined(_WIN32)
+                mapping = CreateFileMappingA(file, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, nullptr);
+
+                if (!mapping)
+                    return false;
+
+                base = MapViewOfFile(mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, _length);
+#else
+                base = mmap(nullptr, _length, writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+
+                if (base == MAP_FAILED)
+                    base = nullptr;
+#endif
+                if (!base)
+                    return false;
+
+                length = _length;
+
+                return true;
+            }
+
+            void* base = nullptr;
+            size_t length = 0;
+
+#if defined(_WIN32)
+            HANDLE file = INVALID_HANDLE_VALUE;
+            HANDLE mapping = nullptr;
+#else
+            int fd = -1;
+#endif
+        };
+    }
+}
@@ -3,8 +3,8 @@
 #pragma once
 
 #include <array>
-
-#include "scalar_t/int.hpp"
+#include <cstddef>
+#include <type_traits>
 
 namespace template_crypto
 {
@@ -34,12 +34,41 @@ namespace template_crypto
             return data;
         }
 
-        template <typename T, size_t height> class PascalTriangle
+        // Row storage of the coefficient tables.
+        // Compact packs the rows back to back, triangles in triangle_number order.
+        // Padded starts every row on a cache line and zero fills it to a whole number of 512 bit vectors,
+        // so row dot products run as aligned full width loads with no remainder.
+        //
+
+        enum class Layout
+        {
+            Compact,
+            Padded
+        };
+
+        constexpr size_t row_align = 64;
+
+        template <typename T> constexpr size_t padded_row(size_t n)
+        {
+            constexpr size_t lanes = (sizeof(T) < row_align) ? row_align / sizeof(T) : 1;
+
+            return (n + lanes - 1) / lanes * lanes;
+        }
+
+        template <typename T, Layout layout> constexpr size_t row_alignment()
+        {
+            return (layout == Layout::Padded && alignof(T) < row_align) ? row_align : alignof(T);
+        }
+
+        template <typename T, size_t height, Layout _layout = Layout::Compact> class PascalTriangle
         {
         public:
             using INT = T;
 
-            constexpr PascalTriangle() : data(make_pascal_triangle<T, height>()) {}
+            static constexpr Layout layout = _layout;
+            static constexpr size_t stride = (layout == Layout::Padded) ? padded_row<T>(height) : 0;
+
+            constexpr PascalTriangle() : PascalTriangle(make_pascal_triangle<T, height>()) {}
 
             constexpr size_t size() const
             {
@@ -48,42 +77,95 @@ namespace template_crypto
 
             constexpr const T* operator[](size_t row) const
             {
-                return data.data() + triangle_number(row);
+                if constexpr (layout == Layout::Padded)
+                    return data.data() + row * stride;
+                else
+                    return data.data() + triangle_number(row);
             }
 
         private:
-            std::array<T, triangle_number(height)> data;
+
+            constexpr PascalTriangle(const std::array<T, triangle_number(height)>& compact)
+            {
+                if constexpr (layout == Layout::Padded)
+                {
+                    for (size_t i = 0; i < height; i++)
+                    {
+                        for (size_t j = 0; j < i + 1; j++)
+                            data[i * stride + j] = compact[triangle_number(i) + j];
+                    }
+                }
+                else
+                    data = compact;
+            }
+
+            alignas(row_alignment<T, layout>()) std::array<T, (layout == Layout::Padded) ? height * stride : triangle_number(height)> data{};
         };
 
-        template <typename T> T GetInverse(T i)
+        // Words narrower than int promote to signed int, where a product can overflow.
+        // Key setup multiplies through this, so it stays well defined when evaluated at compile time.
+        //
+
+        template <typename T> using promoted_t = std::conditional_t<!std::is_class<T>() && (sizeof(T) < sizeof(unsigned)), unsigned, T>;
+
+        template <typename T> constexpr T Product(T a, T b)
+        {
+            return T(promoted_t<T>(a) * promoted_t<T>(b));
+        }
+
+        // Inverse of odd a mod 2^w by Newton / Hensel lifting, each x(2 - ax) doubles the good low bits of x.
+        // Built in words start from 3a ^ 2, right to 5 bits for any odd a, so a 64 bit inverse is 4 steps and a 128 bit one 5.
+        // The wide sse_int words only bring + - *, they start from a, which is right to 3 bits as a * a = 1 mod 8.
+        //
+
+        template <typename T> constexpr size_t inverse_start_bits()
+        {
+            return std::is_class<T>() ? 3 : 5;
+        }
+
+        template <typename T> constexpr T Inverse(T a)
         {
-            if constexpr (std::is_class<T>())
-                return i.MultiplicativeInverse();
-            else
-                //Use scalar_t to compute inverse and account for potential overflow.
-                return (T)scalar_t::uintv_t<T, 1>(i).MultiplicativeInverse()[0];
+            using W = promoted_t<T>;
+
+            W x = a;
+
+            if constexpr (!std::is_class<T>())
+                x = (W(3) * x) ^ W(2);
+
+            for (size_t bits = inverse_start_bits<T>(); bits < sizeof(T) * 8; bits *= 2)
+                x = x * (W(2) - W(a) * x);
+
+            return T(x);
+        }
+
+        template <typename T> constexpr T GetInverse(T i)
+        {
+            return Inverse(i);
         }
 
-        template <typename T, size_t side> class ElectiveTransform
+        template <typename T, size_t side, Layout _layout = Layout::Compact> class ElectiveTransform
         {
         public:
             using INT = T;
 
+            static constexpr Layout layout = _layout;
+            static constexpr size_t stride = (layout == Layout::Padded) ? padded_row<T>(side) : 0;
+
             constexpr ElectiveTransform(const std::array<T, side> & symmetry)
             {
                 auto first = symmetry[0];
                 if (first % 2 == 0)
                     first++;
 
-                for (size_t i = 0, c = 0; i < side; i++)
+                for (size_t i = 0; i < side; i++)
                 {
-                    data[c++] = first;
+                    data[Index(i, 0)] = first;
                     for (size_t j = 1; j < i + 1; j++)
-                        data[c++] = symmetry[j];
+                        data[Index(i, j)] = symmetry[j];
                 }
 
-                if (data[0] != 1)
-                    mul_inverse = GetInverse(data[0]);
+                if (first != 1)
+                    mul_inverse = GetInverse(first);
                 else
                     mul_inverse = 1;
             }
@@ -92,15 +174,21 @@ namespace template_crypto
 
             constexpr const T* operator[](size_t row) const
             {
-                return data.data() + triangle_number(row);
+                return data.data() + Index(row, 0);
             }
 
-            T inverse() const { return mul_inverse; }
+            constexpr T inverse() const { return mul_inverse; }
 
         private:
+
+            static constexpr size_t Index(size_t row, size_t column)
+            {
+                return ((layout == Layout::Padded) ? row * stride : triangle_number(row)) + column;
+            }
+
             T mul_inverse = 0;
 
-            std::array<T, triangle_number(side)> data;
+            alignas(row_alignment<T, layout>()) std::array<T, (layout == Layout::Padded) ? side * stride : triangle_number(side)> data{};
         };
 
         template <typename T, size_t side> class ElectiveTransform2
@@ -118,22 +206,53 @@ namespace template_crypto
                     mul_inverse = GetInverse(sym[0]);
                 else
                     mul_inverse = 1;
+
+                // Inverse power series of the symmetry, so the triangular Toeplitz solve
+                // becomes a plain truncated convolution per block.
+                //
+
+                inv_series[0] = mul_inverse;
+
+                for (size_t i = 1; i < side; i++)
+                {
+                    T sum = 0;
+                    for (size_t j = 1; j < i + 1; j++)
+                        sum += Product(sym[j], inv_series[i - j]);
+
+                    inv_series[i] = T(0) - Product(sum, mul_inverse);
+                }
             }
 
-            const T & inverse() const { return mul_inverse; }
-            const auto& symmetry() const { return sym; }
+            constexpr const T & inverse() const { return mul_inverse; }
+            constexpr const auto& symmetry() const { return sym; }
+            constexpr const auto& series() const { return inv_series; }
 
         private:
             T mul_inverse = 0;
             std::array<T, side> sym;
+            std::array<T, side> inv_series{};
         };
 
-        template <size_t height, typename T, size_t side > class ElectiveSymmetry
+        // Padded rows are also stored back to front, the order ToFunction walks them in against the polynomial,
+        // so Row(dx) is a plain forward dot product. operator[] keeps the coefficient order either way.
+        //
+
+        template <size_t height, typename T, size_t side, Layout _layout = Layout::Compact> class ElectiveSymmetry
         {
         public:
             using INT = T;
 
-            ElectiveSymmetry(const std::array<T, side>& symmetry)
+            static constexpr Layout layout = _layout;
+            static constexpr size_t stride = (layout == Layout::Padded) ? padded_row<T>(side) : side;
+
+            struct Reversed
+            {
+                const T* row;
+
+                constexpr const T& operator[](size_t p) const { return row[side - 1 - p]; }
+            };
+
+            constexpr ElectiveSymmetry(const std::array<T, side>& symmetry)
             {
                 auto first = symmetry[0];
                 if (first % 2 == 0)
@@ -143,27 +262,49 @@ namespace template_crypto
                     T add_inverse = T(0) - first;
 
                     for (size_t i = 1; i < height; i++)
-                        data[i * side] = (i % 2) ? add_inverse : first;
+                        data[Index(i, 0)] = (i % 2) ? add_inverse : first;
                 }  
 
-                data[0] = first;
+                data[Index(0, 0)] = first;
 
                 for (size_t i = 1; i < side; i++)
-                    data[i] = symmetry[i];
+                    data[Index(0, i)] = symmetry[i];
 
                 for (size_t i = 1; i < side; i++)
                 {
                     for (size_t j = 1; j < height; j++)
-                        data[j * side + i] = data[(j - 1) * side + i - 1] - data[(j - 1) * side + i];
+                        data[Index(j, i)] = data[Index(j - 1, i - 1)] - data[Index(j - 1, i)];
                 }
             }
 
             constexpr size_t size() const { return height; }
 
-            constexpr const T* operator[](size_t dx) const { return data.data() + dx * side; }
+            constexpr auto operator[](size_t dx) const
+            {
+                if constexpr (layout == Layout::Padded)
+                    return Reversed{ Row(dx) };
+                else
+                    return data.data() + dx * stride;
+            }
+
+            // Row dx in kernel read order, coefficient side - 1 first.
+            //
+
+            constexpr const T* Row(size_t dx) const
+            {
+                static_assert(layout == Layout::Padded, "compact rows are stored in coefficient order");
+
+                return data.data() + dx * stride;
+            }
 
         private:
-            std::array<T, height * side> data;
+
+            static constexpr size_t Index(size_t row, size_t column)
+            {
+                return row * stride + ((layout == Layout::Padded) ? side - 1 - column : column);
+            }
+
+            alignas(row_alignment<T, layout>()) std::array<T, height * stride> data{};
         };
 
         template <typename I, typename O, typename PT> constexpr void ToPascal(const I& data, O& output, const PT & triangle)
@@ -172,8 +313,42 @@ namespace template_crypto
             {
                 output[i] = 0;
                 auto row = triangle[i];
-                for (size_t j = 0; j < i+1; j++)
-                    output[i] += row[j] * data[j];
+
+                // Padded rows are zero past the diagonal, a full width row vectorizes without a ragged end.
+                //
+
+                size_t width = (PT::layout == Layout::Padded) ? data.size() : i + 1;
+
+                for (size_t j = 0; j < width; j++)
+                    output[i] += Product(row[j], data[j]);
+            }
+        }
+
+        template <typename I, typename O> constexpr void ToPascalAdditive(const I& data, O& output)
+        {
+            for (size_t i = 0; i < data.size(); i++)
+                output[i] = data[i];
+
+            // Each sweep of prefix additions lifts the tail by one row of the triangle,
+            // giving the same binomial transform as ToPascal without the table or multiplies.
+            //
+
+            for (size_t l = 1; l < output.size(); l++)
+            {
+                for (size_t i = output.size() - 1; i >= l; i--)
+                    output[i] += output[i - 1];
+            }
+        }
+
+        template <typename I, typename O> constexpr void FromPascalAdditive(const I& data, O& output)
+        {
+            for (size_t i = 0; i < data.size(); i++)
+                output[i] = data[i];
+
+            for (size_t l = 1; l < output.size(); l++)
+            {
+                for (size_t i = output.size() - 1; i >= l; i--)
+                    output[i] -= output[i - 1];
             }
         }
 
@@ -183,8 +358,18 @@ namespace template_crypto
             {
                 output[k] = 0;
 
-                for (size_t j = 0, p = polynomial.size() - 1; j < polynomial.size(); j++, p--)
-                    output[k] += es[i][p] * polynomial[j];
+                if constexpr (ES::layout == Layout::Padded)
+                {
+                    auto row = es.Row(i);
+
+                    for (size_t j = 0; j < polynomial.size(); j++)
+                        output[k] += Product(row[j], polynomial[j]);
+                }
+                else
+                {
+                    for (size_t j = 0, p = polynomial.size() - 1; j < polynomial.size(); j++, p--)
+                        output[k] += Product(es[i][p], polynomial[j]);
+                }
             }
         }
 
@@ -192,21 +377,175 @@ namespace template_crypto
         {
             for (size_t i = 0, k = _pascal.size() - 1; i < output.size(); i++, k--)
             {
-                output[i] = _pascal[k]; output[i] *= et.inverse();
+                output[i] = Product(_pascal[k], et.inverse());
 
                 for (size_t j = i, p = 0; j > 0; j--, p++)
-                    output[i] += typename ET::INT(0) - (et[i][j] * output[p] * et.inverse());
+                    output[i] += typename ET::INT(0) - Product(Product(et[i][j], output[p]), et.inverse());
             }
         }
 
         template <typename PASCAL_FORM, typename O, typename ET2> constexpr void ToPolynomial2(const PASCAL_FORM& _pascal, O& output, const ET2& et)
         {
+            const auto& series = et.series();
+
             for (size_t i = 0, k = _pascal.size() - 1; i < output.size(); i++, k--)
             {
-                output[i] = _pascal[k]; output[i] *= et.inverse();
+                output[i] = 0;
 
-                for (size_t j = i, p = 0; j > 0; j--, p++)
-                    output[i] += typename ET2::INT(0) - (et.symmetry()[j] * output[p] * et.inverse());
+                for (size_t j = 0; j < i + 1; j++)
+                    output[i] += Product(series[j], _pascal[k + j]);
+            }
+        }
+
+        // From large_block_threshold up the contexts swap the quadratic multiply kernels for Karatsuba convolutions.
+        // Results are bit-identical, arithmetic is exact mod 2^w either way.
+        // Toom-3 is not an option as it divides by 2 and 3.
+        //
+        // Below the threshold the quadratic kernels run 16 blocks side by side in SIMD lanes while Karatsuba runs one block at a time,
+        // and the lanes win at every size up to 512 (u64, 4 MiB, AVX-512: at N = 256 0.13 / 0.16 GB/s encrypt / decrypt against 0.06 / 0.06,
+        // at N = 512 about twice as fast both ways). Karatsuba only pulls ahead for decrypt at N = 1024, where the side^2 table falls out of L2.
+        // The threshold stays at 512 rather than 1024 to keep the per key tables of a context at or under 2 MiB.
+        //
+
+        constexpr size_t karatsuba_threshold = 16;
+        constexpr size_t large_block_threshold = 512;
+
+        constexpr size_t karatsuba_scratch(size_t n)
+        {
+            return (n <= karatsuba_threshold) ? 0 : 4 * (n - n / 2) + karatsuba_scratch(n - n / 2);
+        }
+
+        template <typename T> constexpr void Karatsuba(const T* a, const T* b, size_t n, T* output, T* scratch)
+        {
+            // output receives the full 2n-1 term product.
+            //
+
+            if (n <= karatsuba_threshold)
+            {
+                for (size_t i = 0; i < 2 * n - 1; i++)
+                    output[i] = 0;
+
+                for (size_t i = 0; i < n; i++)
+                {
+                    for (size_t j = 0; j < n; j++)
+                        output[i + j] += Product(a[i], b[j]);
+                }
+
+                return;
+            }
+
+            size_t low = n / 2, high = n - low;
+
+            T* sum_a = scratch;
+            T* sum_b = sum_a + high;
+            T* middle = sum_b + high;
+            T* next = middle + 2 * high;
+
+            for (size_t i = 0; i < high; i++)
+            {
+                sum_a[i] = a[low + i];
+                sum_b[i] = b[low + i];
+
+                if (i < low)
+                {
+                    sum_a[i] += a[i];
+                    sum_b[i] += b[i];
+                }
+            }
+
+            Karatsuba(a, b, low, output, next);
+            output[2 * low - 1] = 0;
+            Karatsuba(a + low, b + low, high, output + 2 * low, next);
+            Karatsuba(sum_a, sum_b, high, middle, next);
+
+            for (size_t i = 0; i < 2 * low - 1; i++)
+                middle[i] -= output[i];
+
+            for (size_t i = 0; i < 2 * high - 1; i++)
+                middle[i] -= output[2 * low + i];
+
+            for (size_t i = 0; i < 2 * high - 1; i++)
+                output[low + i] += middle[i];
+        }
+
+        template <typename T, size_t n, typename ET2> void ToPolynomialLarge(const std::array<T, n>& _pascal, std::array<T, n>& output, const ET2& et)
+        {
+            std::array<T, n> reversed;
+            std::array<T, 2 * n> product;
+            std::array<T, karatsuba_scratch(n) + 1> scratch;
+
+            for (size_t i = 0; i < n; i++)
+                reversed[i] = _pascal[n - 1 - i];
+
+            Karatsuba(et.series().data(), reversed.data(), n, product.data(), scratch.data());
+
+            for (size_t i = 0; i < n; i++)
+                output[i] = product[i];
+        }
+
+        template <typename T, size_t n, typename ES> void ToFunctionLarge(const std::array<T, n>& polynomial, std::array<T, n>& output, const ES& es)
+        {
+            // Row k of the symmetry is (x - 1)^k S(x), so every output is the top coefficient of S * polynomial
+            // pushed through the inverse binomial transform. Only row 0 of es is read.
+            //
+
+            static_assert(ES::layout == Layout::Compact, "Karatsuba reads row 0 in coefficient order");
+
+            std::array<T, n> top;
+            std::array<T, 2 * n> product;
+            std::array<T, karatsuba_scratch(n) + 1> scratch;
+
+            Karatsuba(es[0], polynomial.data(), n, product.data(), scratch.data());
+
+            for (size_t m = 0; m < n; m++)
+                top[m] = product[n - 1 - m];
+
+            FromPascalAdditive(top, output);
+        }
+
+        template <typename T, size_t side> class FusedTransform
+        {
+        public:
+            using INT = T;
+
+            constexpr FusedTransform(const ElectiveTransform2<T, side>& et)
+            {
+                // Both stages are linear over Z/2^w, so pushing each basis vector through them
+                // once recovers the columns of the combined matrix.
+                //
+
+                std::array<T, side> unit{}, pascal{}, column{};
+
+                for (size_t j = 0; j < side; j++)
+                {
+                    unit[j] = 1;
+
+                    ToPascalAdditive(unit, pascal);
+                    ToPolynomial2(pascal, column, et);
+
+                    unit[j] = 0;
+
+                    for (size_t i = 0; i < side; i++)
+                        data[i * side + j] = column[i];
+                }
+            }
+
+            constexpr size_t size() const { return side; }
+
+            constexpr const T* operator[](size_t row) const { return data.data() + row * side; }
+
+        private:
+            std::array<T, side * side> data{};
+        };
+
+        template <typename I, typename O, typename FT> constexpr void ToFused(const I& data, O& output, const FT& ft)
+        {
+            for (size_t i = 0; i < output.size(); i++)
+            {
+                output[i] = 0;
+                auto row = ft[i];
+                for (size_t j = 0; j < data.size(); j++)
+                    output[i] += Product(row[j], data[j]);
             }
         }
     } 
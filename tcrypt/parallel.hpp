@@ -0,0 +1,171 @@
+/* Copyright (C) 2020 D8DATAWORKS - All Rights Reserved */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace template_crypto
+{
+    namespace parallel
+    {
+        inline size_t Threads(size_t threads)
+        {
+            if (!threads)
+                threads = std::thread::hardware_concurrency();
+
+            return threads ? threads : 1;
+        }
+
+        template <typename F> void For(size_t tasks, size_t threads, F&& f)
+        {
+            // Workers claim tasks from a shared counter, so uneven tasks balance themselves.
+            //
+
+            threads = std::min(Threads(threads), tasks);
+
+            if (threads <= 1)
+            {
+                for (size_t i = 0; i < tasks; i++)
+                    f(i);
+
+                return;
+            }
+
+            std::atomic<size_t> next(0);
+
+            auto worker = [&]()
+            {
+                for (size_t i = next++; i < tasks; i = next++)
+                    f(i);
+            };
+
+            std::vector<std::thread> pool;
+            pool.reserve(threads - 1);
+
+            for (size_t t = 1; t < threads; t++)
+                pool.emplace_back(worker);
+
+            worker();
+
+            for (auto& t : pool)
+                t.join();
+        }
+
+        // Long lived workers for callers that run many jobs, so threads are not spawned per buffer.
+        // Tasks of a job are claimed one at a time from a shared counter by the workers and the calling thread,
+        // an idle worker always picks up the next unclaimed task.
+        //
+
+        class Pool
+        {
+        public:
+
+            explicit Pool(size_t threads = 0)
+            {
+                threads = Threads(threads);
+
+                for (size_t t = 1; t < threads; t++)
+                    workers.emplace_back([this]() { Worker(); });
+            }
+
+            ~Pool()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m);
+                    stop = true;
+                }
+
+                wake.notify_all();
+
+                for (auto& t : workers)
+                    t.join();
+            }
+
+            Pool(const Pool&) = delete;
+            Pool& operator=(const Pool&) = delete;
+
+            size_t size() const { return workers.size() + 1; }
+
+            template <typename F> void For(size_t tasks, F&& f)
+            {
+                std::function<void(size_t)> task(std::forward<F>(f));
+
+                std::lock_guard<std::mutex> serial(submit);
+
+                {
+                    std::lock_guard<std::mutex> lock(m);
+
+                    job = &task;
+                    job_tasks = tasks;
+                    next = 0;
+                    active = workers.size();
+                    generation++;
+                }
+
+                wake.notify_all();
+
+                Work();
+
+                std::unique_lock<std::mutex> lock(m);
+                done.wait(lock, [&]() { return active == 0; });
+
+                job = nullptr;
+            }
+
+        private:
+
+            void Work()
+            {
+                for (size_t i = next++; i < job_tasks; i = next++)
+                    (*job)(i);
+            }
+
+            void Worker()
+            {
+                size_t seen = 0;
+
+                for (;;)
+                {
+                    {
+                        std::unique_lock<std::mutex> lock(m);
+                        wake.wait(lock, [&]() { return stop || generation != seen; });
+
+                        if (stop)
+                            return;
+
+                        seen = generation;
+                    }
+
+                    Work();
+
+                    {
+                        std::lock_guard<std::mutex> lock(m);
+
+                        if (--active == 0)
+                            done.notify_one();
+                    }
+                }
+            }
+
+            std::mutex submit;
+            std::mutex m;
+            std::condition_variable wake;
+            std::condition_variable done;
+
+            const std::function<void(size_t)>* job = nullptr;
+            size_t job_tasks = 0;
+            std::atomic<size_t> next{ 0 };
+            size_t active = 0;
+            size_t generation = 0;
+            bool stop = false;
+
+            std::vector<std::thread> workers;
+        };
+    }
+}
\ No newline at end of file
@@ -9,6 +9,11 @@
 
 namespace polynomial_custom_field_encryption
 {
+	inline const char* pcf256_kernel()
+	{
+		return template_crypto::cpu::Name(template_crypto::cpu::Active());
+	}
+
 	template < typename T, typename P > void pcf256_enc(T & data, const P & p)
 	{
 		using B = std::array<uint64_t, 4>;
@@ -28,6 +33,14 @@ namespace polynomial_custom_field_encryption
 		return copy;
 	}
 
+	template < typename T, typename D, typename P > void pcf256_enc_copy(const T& data, D& out, const P& p)
+	{
+		using B = std::array<uint64_t, 4>;
+		template_crypto::encrypt::Long<uint64_t, 4> lec(*((B*)&p), *(((B*)&p) + 1));
+
+		lec.Encrypt(data, out);
+	}
+
 	template < typename T, typename P > void pcf256_dec(T& data, const P& p)
 	{
 		using B = std::array<uint64_t, 4>;
@@ -0,0 +1,295 @@
+/* Copyright (C) 2020 D8DATAWORKS - All Rights Reserved */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Build with TCRYPT_PERF to count hardware events around the Long encrypt and decrypt calls and the large block Run kernels.
+// Without it the hooks compile to nothing. Counters need Linux and a perf_event_paranoid that allows user space counting,
+// elsewhere only calls are counted.
+//
+
+#if defined(TCRYPT_PERF)
+#define TCRYPT_PERF_SCOPE(region) template_crypto::perf::Scope tcrypt_perf_scope(template_crypto::perf::Region::region)
+#define TCRYPT_PERF_SCOPE_IF(region, active) template_crypto::perf::Scope tcrypt_perf_scope(template_crypto::perf::Region::region, active)
+#else
+#define TCRYPT_PERF_SCOPE(region)
+#define TCRYPT_PERF_SCOPE_IF(region, active)
+#endif
+
+namespace template_crypto
+{
+    namespace perf
+    {
+        enum class Region : int
+        {
+            EncryptLoop,
+            DecryptLoop,
+            EncodeRun,
+            DecodeRun,
+            Count
+        };
+
+        inline const char* Name(Region r)
+        {
+            switch (r)
+            {
+            case Region::EncryptLoop: return "encrypt loop";
+            case Region::DecryptLoop: return "decrypt loop";
+            case Region::EncodeRun: return "encode run";
+            case Region::DecodeRun: return "decode run";
+            default: return "?";
+            }
+        }
+
+        enum Event
+        {
+            Cycles,
+            Instructions,
+            L1Misses,
+            LlcMisses,
+            BranchMisses,
+            Events
+        };
+
+        inline const char* Name(Event e)
+        {
+            switch (e)
+            {
+            case Cycles: return "cycles";
+            case Instructions: return "instructions";
+            case L1Misses: return "l1d_misses";
+            case LlcMisses: return "llc_misses";
+            case BranchMisses: return "branch_misses";
+            default: return "?";
+            }
+        }
+
+        using Counts = std::array<uint64_t, Events>;
+
+        // Raw counts with the times the group was enabled and actually counting, as the kernel reports them.
+        //
+
+        struct Sample
+        {
+            Counts counts = {};
+            uint64_t enabled = 0;
+            uint64_t running = 0;
+        };
+
+        // One counter group per thread, opened on first use. Events the host does not offer read as zero.
+        // When the PMU has fewer counters than events the kernel time slices the group, so the difference of
+        // two samples is scaled by the time enabled over the time running between them, see Delta.
+        //
+
+        class Group
+        {
+        public:
+
+            Group()
+            {
+#if defined(__linux__)
+                const std::pair<uint32_t, uint64_t> events[Events] =
+                {
+                    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+                    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+                    { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+                    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+                    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+                };
+
+                for (size_t e = 0; e < Events; e++)
+                {
+                    perf_event_attr attr = {};
+
+                    attr.size = sizeof(attr);
+                    attr.type = events[e].first;
+                    attr.config = events[e].second;
+                    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+                    attr.disabled = leader < 0;
+                    attr.exclude_kernel = 1;
+                    attr.exclude_hv = 1;
+
+                    int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+
+                    if (fd < 0)
+                        continue;
+
+                    if (leader < 0)
+                        leader = fd;
+
+                    slot[members] = e;
+                    fds[members++] = fd;
+                }
+
+                if (leader >= 0)
+                    ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+            }
+
+            ~Group()
+            {
+#if defined(__linux__)
+                for (size_t m = 0; m < members; m++)
+                    close(fds[m]);
+#endif
+            }
+
+            bool available() const { return leader >= 0; }
+
+            Sample Read() const
+            {
+                Sample sample;
+#if defined(__linux__)
+                // nr, time enabled, time running, then one value per member.
+                //
+
+                uint64_t buffer[3 + Events];
+
+                if (leader >= 0 && read(leader, buffer, sizeof(buffer)) > 0)
+                {
+                    sample.enabled = buffer[1];
+                    sample.running = buffer[2];
+
+                    for (size_t m = 0; m < buffer[0] && m < members; m++)
+                        sample.counts[slot[m]] = buffer[3 + m];
+                }
+#endif
+                return sample;
+            }
+
+            // Events between two samples. Scaling each cumulative total by its own ratio and subtracting can go negative
+            // when multiplexing changes the ratio in between, so the raw difference is scaled by the ratio over the interval.
+            // An interval the group never ran in counts nothing.
+            //
+
+            static Counts Delta(const Sample& start, const Sample& end)
+            {
+                Counts counts = {};
+
+                uint64_t running = end.running - start.running;
+
+                if (!running)
+                    return counts;
+
+                double scale = (double)(end.enabled - start.enabled) / (double)running;
+
+                for (size_t e = 0; e < Events; e++)
+                    counts[e] = (uint64_t)((end.counts[e] - start.counts[e]) * scale);
+
+                return counts;
+            }
+
+            static Group& This()
+            {
+                thread_local Group group;
+                return group;
+            }
+
+        private:
+            int leader = -1;
+
+            std::array<int, Events> fds = {};
+            std::array<size_t, Events> slot = {};
+            size_t members = 0;
+        };
+
+        struct Totals
+        {
+            std::atomic<uint64_t> calls{ 0 };
+            std::array<std::atomic<uint64_t>, Events> counts = {};
+        };
+
+        inline std::array<Totals, (size_t)Region::Count>& Summary()
+        {
+            static std::array<Totals, (size_t)Region::Count> totals;
+            return totals;
+        }
+
+        inline void Reset()
+        {
+            for (auto& t : Summary())
+            {
+                t.calls = 0;
+
+                for (auto& c : t.counts)
+                    c = 0;
+            }
+        }
+
+        // Counts from construction to destruction into the totals of region, an inactive scope does nothing.
+        // Each end is one read syscall, so scopes belong around whole calls or kernels that run far longer than that.
+        // A scope nested in another counts into both regions, the outer one including the reads of the inner.
+        //
+
+        class Scope
+        {
+        public:
+
+            Scope(Region _region, bool _active = true)
+                : region(_region)
+                , active(_active)
+            {
+                if (active)
+                    start = Group::This().Read();
+            }
+
+            ~Scope()
+            {
+                if (!active)
+                    return;
+
+                auto counts = Group::Delta(start, Group::This().Read());
+                auto& totals = Summary()[(size_t)region];
+
+                totals.calls.fetch_add(1, std::memory_order_relaxed);
+
+                for (size_t e = 0; e < Events; e++)
+                    totals.counts[e].fetch_add(counts[e], std::memory_order_relaxed);
+            }
+
+        private:
+            Region region;
+            bool active;
+            Sample start;
+        };
+
+        inline void Report(std::ostream& out)
+        {
+            out << "region,calls";
+
+            for (size_t e = 0; e < Events; e++)
+                out << ',' << Name((Event)e);
+
+            out << ",ipc,cycles_per_call" << std::endl;
+
+            for (size_t r = 0; r < (size_t)Region::Count; r++)
+            {
+                auto& t = Summary()[r];
+                uint64_t calls = t.calls;
+
+                if (!calls)
+                    continue;
+
+                out << Name((Region)r) << ',' << calls;
+
+                for (size_t e = 0; e < Events; e++)
+                    out << ',' << t.counts[e];
+
+                double cycles = (double)t.counts[Cycles];
+
+                out << ',' << (cycles ? t.counts[Instructions] / cycles : 0) << ',' << cycles / calls << std::endl;
+            }
+        }
+    }
+}
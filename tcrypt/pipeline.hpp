@@ -0,0 +1,367 @@
+/* Copyright (C) 2020 D8DATAWORKS - All Rights Reserved */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <cerrno>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#include "block.hpp"
+
+#include "d8u/memory.hpp"
+
+namespace template_crypto
+{
+    namespace pipeline
+    {
+        // Single producer single consumer ring. Head and tail sit on their own cache lines,
+        // each side only writes its own index, so neither takes a lock.
+        // A consumer that finds it empty spins briefly and then sleeps in Wait until a Push or Close wakes it.
+        //
+
+        template <typename T> class Spsc
+        {
+        public:
+
+            Spsc(size_t count)
+            {
+                while (capacity < count)
+                    capacity *= 2;
+
+                ring.resize(capacity);
+            }
+
+            bool Push(const T& value)
+            {
+                size_t t = tail.load(std::memory_order_relaxed);
+
+                if (t - head.load(std::memory_order_acquire) == capacity)
+                    return false;
+
+                ring[t & (capacity - 1)] = value;
+                tail.store(t + 1, std::memory_order_release);
+
+                Signal();
+
+                return true;
+            }
+
+            bool Pop(T& value)
+            {
+                size_t h = head.load(std::memory_order_relaxed);
+
+                if (h == tail.load(std::memory_order_acquire))
+                    return false;
+
+                value = ring[h & (capacity - 1)];
+                head.store(h + 1, std::memory_order_release);
+
+                return true;
+            }
+
+            // Pop, blocking while the ring is empty. Returns false once the ring is closed.
+            //
+
+            bool Wait(T& value)
+            {
+                for (size_t spin = 0; spin < spins; spin++)
+                {
+                    if (Pop(value))
+                        return true;
+
+                    if (closed.load(std::memory_order_relaxed))
+                        return false;
+                }
+
+                for (;;)
+                {
+                    uint32_t seen = signal.load(std::memory_order_acquire);
+
+                    if (Pop(value))
+                        return true;
+
+                    if (closed.load(std::memory_order_acquire))
+                        return false;
+
+                    signal.wait(seen, std::memory_order_acquire);
+                }
+            }
+
+            // Wake the consumer and make every later Wait on an empty ring fail.
+            //
+
+            void Close()
+            {
+                closed.store(true, std::memory_order_release);
+                Signal();
+            }
+
+        private:
+            static constexpr size_t spins = 256;
+
+            void Signal()
+            {
+                signal.fetch_add(1, std::memory_order_release);
+                signal.notify_one();
+            }
+
+            size_t capacity = 1;
+            std::vector<T> ring;
+
+            alignas(64) std::atomic<size_t> head{ 0 };
+            alignas(64) std::atomic<size_t> tail{ 0 };
+
+            std::atomic<uint32_t> signal{ 0 };
+            std::atomic<bool> closed{ false };
+        };
+
+        // A stage stalls when the stage before it has nothing ready, for the reader when no buffer has come back from the writer.
+        // Stalls in the reader point at the cipher or the writer, stalls in the cipher at the reader, stalls in the writer at the cipher.
+        //
+
+        struct Stage
+        {
+            uint64_t bytes = 0;
+            uint64_t stalls = 0;
+            uint64_t stall_ns = 0;
+        };
+
+        struct Stats
+        {
+            Stage read;
+            Stage crypt;
+            Stage write;
+
+            bool ok = true;
+        };
+
+        // Wait until fd is ready for events, waking every few milliseconds to see if another stage has failed.
+        // Returns false once stop is set. A thread blocked in read or write could not be joined after a failure elsewhere.
+        //
+
+        inline bool Ready(int fd, short events, const std::atomic<bool>& stop)
+        {
+#if defined(_WIN32)
+            return !stop.load(std::memory_order_relaxed);
+#else
+            pollfd p = { fd, events, 0 };
+
+            while (!stop.load(std::memory_order_relaxed))
+            {
+                int r = poll(&p, 1, 20);
+
+                if (r > 0 || (r < 0 && errno != EINTR))
+                    return true;
+            }
+
+            return false;
+#endif
+        }
+
+        inline long long ReadSome(int fd, uint8_t* data, size_t size, const std::atomic<bool>& stop)
+        {
+#if defined(_WIN32)
+            return Ready(fd, 0, stop) ? _read(fd, data, (unsigned)size) : -1;
+#else
+            for (;;)
+            {
+                if (!Ready(fd, POLLIN, stop))
+                    return -1;
+
+                auto r = read(fd, data, size);
+
+                if (r >= 0 || errno != EINTR)
+                    return r;
+            }
+#endif
+        }
+
+        inline bool WriteAll(int fd, const uint8_t* data, size_t size, const std::atomic<bool>& stop)
+        {
+            while (size)
+            {
+#if defined(_WIN32)
+                if (!Ready(fd, 0, stop))
+                    return false;
+
+                auto w = _write(fd, data, (unsigned)size);
+#else
+                if (!Ready(fd, POLLOUT, stop))
+                    return false;
+
+                auto w = write(fd, data, size);
+
+                if (w < 0 && errno == EINTR)
+                    continue;
+#endif
+                if (w <= 0)
+                    return false;
+
+                data += w; size -= (size_t)w;
+            }
+
+            return true;
+        }
+
+        // Read in_fd to the end, pass it through the Stream of key and write the result to out_fd.
+        // A reader thread, the calling thread as the cipher and a writer thread hand a ring of buffers round through three queues,
+        // so the syscalls on both sides overlap the block computation.
+        // key is encrypt::Long or decrypt::Long, buffer_bytes should be a multiple of its block size.
+        //
+
+        template <typename CIPHER> Stats Run(const CIPHER& key, int in_fd, int out_fd, size_t buffer_bytes = 1024 * 1024, size_t buffers = 4)
+        {
+            struct Slot
+            {
+                d8u::aligned_vector in;
+                d8u::aligned_vector out;
+                size_t in_size = 0;
+                size_t out_size = 0;
+                bool last = false;
+            };
+
+            std::vector<Slot> slots(buffers);
+
+            // The stream can emit up to two blocks more than it is given.
+            //
+
+            for (auto& slot : slots)
+            {
+                slot.in.resize(buffer_bytes);
+                slot.out.resize(buffer_bytes + 2 * CIPHER::block_bytes());
+            }
+
+            Spsc<Slot*> free(buffers), filled(buffers), done(buffers);
+
+            for (auto& slot : slots)
+                free.Push(&slot);
+
+            Stats stats;
+            std::atomic<bool> failed(false);
+
+            // A failing stage closes every queue, so the others wake from Wait, and their polls see failed, then all of them return.
+            //
+
+            auto fail = [&]()
+            {
+                failed = true;
+
+                free.Close();
+                filled.Close();
+                done.Close();
+            };
+
+            auto wait = [&](Spsc<Slot*>& queue, Slot*& slot, Stage& stage)
+            {
+                if (queue.Pop(slot))
+                    return true;
+
+                auto start = std::chrono::steady_clock::now();
+                stage.stalls++;
+
+                if (!queue.Wait(slot))
+                    return false;
+
+                stage.stall_ns += (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+                return true;
+            };
+
+            std::thread reader([&]()
+            {
+                for (Slot* slot; wait(free, slot, stats.read);)
+                {
+                    slot->in_size = 0;
+                    slot->last = false;
+
+                    // Fill the whole buffer, pipes and sockets return whatever has arrived.
+                    //
+
+                    while (slot->in_size < buffer_bytes)
+                    {
+                        auto r = ReadSome(in_fd, slot->in.data() + slot->in_size, buffer_bytes - slot->in_size, failed);
+
+                        if (r < 0)
+                        {
+                            fail();
+                            return;
+                        }
+
+                        if (r == 0)
+                        {
+                            slot->last = true;
+                            break;
+                        }
+
+                        slot->in_size += (size_t)r;
+                    }
+
+                    stats.read.bytes += slot->in_size;
+                    filled.Push(slot);
+
+                    if (slot->last)
+                        return;
+                }
+            });
+
+            std::thread writer([&]()
+            {
+                for (Slot* slot; wait(done, slot, stats.write);)
+                {
+                    if (!WriteAll(out_fd, slot->out.data(), slot->out_size, failed))
+                    {
+                        fail();
+                        return;
+                    }
+
+                    stats.write.bytes += slot->out_size;
+
+                    if (slot->last)
+                        return;
+
+                    free.Push(slot);
+                }
+            });
+
+            typename CIPHER::Stream stream(key);
+
+            for (Slot* slot; wait(filled, slot, stats.crypt);)
+            {
+                slot->out_size = stream.Update(slot->in.data(), slot->in_size, slot->out.data());
+
+                if (slot->last)
+                    slot->out_size += stream.Finalize(slot->out.data() + slot->out_size);
+
+                stats.crypt.bytes += slot->out_size;
+                done.Push(slot);
+
+                if (slot->last)
+                    break;
+            }
+
+            reader.join();
+            writer.join();
+
+            for (auto& slot : slots)
+            {
+                block::Wipe(slot.in.data(), slot.in.size());
+                block::Wipe(slot.out.data(), slot.out.size());
+            }
+
+            stats.ok = !failed;
+
+            return stats;
+        }
+    }
+}
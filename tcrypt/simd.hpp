@@ -0,0 +1,643 @@
+/* Copyright (C) 2020 D8DATAWORKS - All Rights Reserved */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "cpu.hpp"
+#include "math.hpp"
+
+namespace template_crypto
+{
+    namespace simd
+    {
+        using namespace math;
+
+        // Coefficient views so every block kernel shares the same lane code.
+        //
+
+        template <typename ES> struct FunctionRows
+        {
+            const ES& es;
+            size_t offset;
+            size_t n;
+
+            constexpr auto operator()(size_t k, size_t j) const
+            {
+                if constexpr (ES::layout == Layout::Padded)
+                    return es.Row(offset + k)[j];
+                else
+                    return es[offset + k][n - 1 - j];
+            }
+        };
+
+        template <typename FT> struct FusedRows
+        {
+            const FT& ft;
+
+            auto operator()(size_t k, size_t j) const { return ft[k][j]; }
+        };
+
+        template <typename T> constexpr bool lane_type()
+        {
+            return std::is_same<T, uint64_t>() || std::is_same<T, uint32_t>();
+        }
+
+#if TCRYPT_X86
+
+        TCRYPT_TARGET("sse4.1") inline __m128i mullo_epi64(__m128i a, __m128i b)
+        {
+            __m128i low = _mm_mul_epu32(a, b);
+            __m128i cross = _mm_add_epi64(_mm_mul_epu32(_mm_srli_epi64(a, 32), b), _mm_mul_epu32(a, _mm_srli_epi64(b, 32)));
+
+            return _mm_add_epi64(low, _mm_slli_epi64(cross, 32));
+        }
+
+        TCRYPT_TARGET("avx2") inline __m256i mullo_epi64(__m256i a, __m256i b)
+        {
+            __m256i low = _mm256_mul_epu32(a, b);
+            __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b), _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+
+            return _mm256_add_epi64(low, _mm256_slli_epi64(cross, 32));
+        }
+
+        // The unmasked AVX-512 forms pass an undefined register through to the builtins, which GCC 12 reports as uninitialized.
+        // The zero-masked forms with every lane selected are the same instructions without that.
+        //
+
+        constexpr __mmask8 all_qwords = 0xff;
+        constexpr __mmask16 all_dwords = 0xffff;
+
+        TCRYPT_TARGET("avx512f") inline __m512i mullo_epi64(__m512i a, __m512i b)
+        {
+            __m512i low = _mm512_maskz_mul_epu32(all_qwords, a, b);
+            __m512i cross = _mm512_add_epi64(_mm512_maskz_mul_epu32(all_qwords, _mm512_maskz_srli_epi64(all_qwords, a, 32), b), _mm512_maskz_mul_epu32(all_qwords, a, _mm512_maskz_srli_epi64(all_qwords, b, 32)));
+
+            return _mm512_add_epi64(low, _mm512_maskz_slli_epi64(all_qwords, cross, 32));
+        }
+
+        template <typename T, size_t n, typename M> TCRYPT_TARGET("sse4.1") void LanesSse41(const std::array<T, n>* in, std::array<T, n>* out, const M& m)
+        {
+            constexpr size_t lanes = 16 / sizeof(T);
+
+            __m128i columns[n];
+            alignas(16) std::array<T, lanes> lane;
+
+            for (size_t j = 0; j < n; j++)
+            {
+                if constexpr (sizeof(T) == 8)
+                    columns[j] = _mm_set_epi64x((long long)in[1][j], (long long)in[0][j]);
+                else
+                    columns[j] = _mm_set_epi32((int)in[3][j], (int)in[2][j], (int)in[1][j], (int)in[0][j]);
+            }
+
+            for (size_t k = 0; k < n; k++)
+            {
+                __m128i acc = _mm_setzero_si128();
+
+                for (size_t j = 0; j < n; j++)
+                {
+                    if constexpr (sizeof(T) == 8)
+                        acc = _mm_add_epi64(acc, mullo_epi64(_mm_set1_epi64x((long long)m(k, j)), columns[j]));
+                    else
+                        acc = _mm_add_epi32(acc, _mm_mullo_epi32(_mm_set1_epi32((int)m(k, j)), columns[j]));
+                }
+
+                _mm_store_si128((__m128i*)lane.data(), acc);
+
+                for (size_t l = 0; l < lanes; l++)
+                    out[l][k] = lane[l];
+            }
+        }
+
+        template <typename T, size_t n, typename M> TCRYPT_TARGET("avx2") void LanesAvx2(const std::array<T, n>* in, std::array<T, n>* out, const M& m)
+        {
+            constexpr size_t lanes = 32 / sizeof(T);
+
+            __m256i columns[n];
+            alignas(32) std::array<T, lanes> lane;
+
+            if constexpr (sizeof(T) == 8)
+            {
+                __m256i index = _mm256_set_epi64x((long long)(3 * n), (long long)(2 * n), (long long)n, 0);
+
+                for (size_t j = 0; j < n; j++)
+                    columns[j] = _mm256_i64gather_epi64((const long long*)(in[0].data() + j), index, 8);
+            }
+            else
+            {
+                __m256i index = _mm256_set_epi32(int(7 * n), int(6 * n), int(5 * n), int(4 * n), int(3 * n), int(2 * n), int(n), 0);
+
+                for (size_t j = 0; j < n; j++)
+                    columns[j] = _mm256_i32gather_epi32((const int*)(in[0].data() + j), index, 4);
+            }
+
+            for (size_t k = 0; k < n; k++)
+            {
+                __m256i acc = _mm256_setzero_si256();
+
+                for (size_t j = 0; j < n; j++)
+                {
+                    if constexpr (sizeof(T) == 8)
+                        acc = _mm256_add_epi64(acc, mullo_epi64(_mm256_set1_epi64x((long long)m(k, j)), columns[j]));
+                    else
+                        acc = _mm256_add_epi32(acc, _mm256_mullo_epi32(_mm256_set1_epi32((int)m(k, j)), columns[j]));
+                }
+
+                _mm256_store_si256((__m256i*)lane.data(), acc);
+
+                for (size_t l = 0; l < lanes; l++)
+                    out[l][k] = lane[l];
+            }
+        }
+
+        template <typename T, size_t n, typename M> TCRYPT_TARGET("avx512f") void LanesAvx512(const std::array<T, n>* in, std::array<T, n>* out, const M& m)
+        {
+            constexpr size_t lanes = 64 / sizeof(T);
+
+            __m512i columns[n];
+            alignas(64) std::array<T, lanes> lane;
+
+            if constexpr (sizeof(T) == 8)
+            {
+                __m512i index = _mm512_set_epi64((long long)(7 * n), (long long)(6 * n), (long long)(5 * n), (long long)(4 * n), (long long)(3 * n), (long long)(2 * n), (long long)n, 0);
+
+                for (size_t j = 0; j < n; j++)
+                    columns[j] = _mm512_mask_i64gather_epi64(_mm512_setzero_si512(), all_qwords, index, (const void*)(in[0].data() + j), 8);
+            }
+            else
+            {
+                __m512i index = _mm512_set_epi32(int(15 * n), int(14 * n), int(13 * n), int(12 * n), int(11 * n), int(10 * n), int(9 * n), int(8 * n),
+                    int(7 * n), int(6 * n), int(5 * n), int(4 * n), int(3 * n), int(2 * n), int(n), 0);
+
+                for (size_t j = 0; j < n; j++)
+                    columns[j] = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), all_dwords, index, (const void*)(in[0].data() + j), 4);
+            }
+
+            for (size_t k = 0; k < n; k++)
+            {
+                __m512i acc = _mm512_setzero_si512();
+
+                for (size_t j = 0; j < n; j++)
+                {
+                    if constexpr (sizeof(T) == 8)
+                        acc = _mm512_add_epi64(acc, mullo_epi64(_mm512_set1_epi64((long long)m(k, j)), columns[j]));
+                    else
+                        acc = _mm512_add_epi32(acc, _mm512_mullo_epi32(_mm512_set1_epi32((int)m(k, j)), columns[j]));
+                }
+
+                _mm512_store_si512((void*)lane.data(), acc);
+
+                for (size_t l = 0; l < lanes; l++)
+                    out[l][k] = lane[l];
+            }
+        }
+
+        // Newton steps of math::Inverse, one key per lane.
+        //
+
+        template <typename T> TCRYPT_TARGET("sse4.1") void InverseSse41(const T* in, T* out)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i*)in);
+            __m128i two = (sizeof(T) == 8) ? _mm_set1_epi64x(2) : _mm_set1_epi32(2);
+            __m128i x;
+
+            if constexpr (sizeof(T) == 8)
+                x = _mm_xor_si128(_mm_add_epi64(a, _mm_add_epi64(a, a)), two);
+            else
+                x = _mm_xor_si128(_mm_add_epi32(a, _mm_add_epi32(a, a)), two);
+
+            for (size_t bits = inverse_start_bits<T>(); bits < sizeof(T) * 8; bits *= 2)
+            {
+                if constexpr (sizeof(T) == 8)
+                    x = mullo_epi64(x, _mm_sub_epi64(two, mullo_epi64(a, x)));
+                else
+                    x = _mm_mullo_epi32(x, _mm_sub_epi32(two, _mm_mullo_epi32(a, x)));
+            }
+
+            _mm_storeu_si128((__m128i*)out, x);
+        }
+
+        template <typename T> TCRYPT_TARGET("avx2") void InverseAvx2(const T* in, T* out)
+        {
+            __m256i a = _mm256_loadu_si256((const __m256i*)in);
+            __m256i two = (sizeof(T) == 8) ? _mm256_set1_epi64x(2) : _mm256_set1_epi32(2);
+            __m256i x;
+
+            if constexpr (sizeof(T) == 8)
+                x = _mm256_xor_si256(_mm256_add_epi64(a, _mm256_add_epi64(a, a)), two);
+            else
+                x = _mm256_xor_si256(_mm256_add_epi32(a, _mm256_add_epi32(a, a)), two);
+
+            for (size_t bits = inverse_start_bits<T>(); bits < sizeof(T) * 8; bits *= 2)
+            {
+                if constexpr (sizeof(T) == 8)
+                    x = mullo_epi64(x, _mm256_sub_epi64(two, mullo_epi64(a, x)));
+                else
+                    x = _mm256_mullo_epi32(x, _mm256_sub_epi32(two, _mm256_mullo_epi32(a, x)));
+            }
+
+            _mm256_storeu_si256((__m256i*)out, x);
+        }
+
+        template <typename T> TCRYPT_TARGET("avx512f") void InverseAvx512(const T* in, T* out)
+        {
+            __m512i a = _mm512_loadu_si512((const void*)in);
+            __m512i two = (sizeof(T) == 8) ? _mm512_set1_epi64(2) : _mm512_set1_epi32(2);
+            __m512i x;
+
+            if constexpr (sizeof(T) == 8)
+                x = _mm512_xor_si512(_mm512_add_epi64(a, _mm512_add_epi64(a, a)), two);
+            else
+                x = _mm512_xor_si512(_mm512_add_epi32(a, _mm512_add_epi32(a, a)), two);
+
+            for (size_t bits = inverse_start_bits<T>(); bits < sizeof(T) * 8; bits *= 2)
+            {
+                if constexpr (sizeof(T) == 8)
+                    x = mullo_epi64(x, _mm512_sub_epi64(two, mullo_epi64(a, x)));
+                else
+                    x = _mm512_mullo_epi32(x, _mm512_sub_epi32(two, _mm512_mullo_epi32(a, x)));
+            }
+
+            _mm512_storeu_si512((void*)out, x);
+        }
+
+        // Register tile of the decrypt GEMM, R blocks by KV vectors of output coefficients starting at k0.
+        // Each input word is broadcast once per tile and each row of the transposed matrix is loaded once per R blocks.
+        // 64 bit products are split into 32 bit halves and the cross terms summed before the shift, as the sums are exact mod 2^64.
+        //
+
+        template <typename T, size_t n, size_t R, size_t KV> TCRYPT_TARGET("avx2") void GemmTileAvx2(const std::array<T, n>* in, std::array<T, n>* out, const T* mt, size_t k0)
+        {
+            constexpr size_t V = 32 / sizeof(T);
+
+            __m256i lo[R][KV], cross[R][KV];
+
+            TCRYPT_UNROLL
+            for (size_t r = 0; r < R; r++)
+            {
+                TCRYPT_UNROLL
+                for (size_t v = 0; v < KV; v++)
+                    lo[r][v] = cross[r][v] = _mm256_setzero_si256();
+            }
+
+            for (size_t j = 0; j < n; j++)
+            {
+                __m256i b[KV], bh[KV];
+
+                TCRYPT_UNROLL
+                for (size_t v = 0; v < KV; v++)
+                {
+                    b[v] = _mm256_loadu_si256((const __m256i*)(mt + j * n + k0 + v * V));
+
+                    if constexpr (sizeof(T) == 8)
+                        bh[v] = _mm256_srli_epi64(b[v], 32);
+                }
+
+                TCRYPT_UNROLL
+                for (size_t r = 0; r < R; r++)
+                {
+                    if constexpr (sizeof(T) == 8)
+                    {
+                        __m256i a = _mm256_set1_epi64x((long long)in[r][j]);
+                        __m256i ah = _mm256_set1_epi64x((long long)(in[r][j] >> 32));
+
+                        TCRYPT_UNROLL
+                        for (size_t v = 0; v < KV; v++)
+                        {
+                            lo[r][v] = _mm256_add_epi64(lo[r][v], _mm256_mul_epu32(a, b[v]));
+                            cross[r][v] = _mm256_add_epi64(cross[r][v], _mm256_add_epi64(_mm256_mul_epu32(ah, b[v]), _mm256_mul_epu32(a, bh[v])));
+                        }
+                    }
+                    else
+                    {
+                        __m256i a = _mm256_set1_epi32((int)in[r][j]);
+
+                        TCRYPT_UNROLL
+                        for (size_t v = 0; v < KV; v++)
+                            lo[r][v] = _mm256_add_epi32(lo[r][v], _mm256_mullo_epi32(a, b[v]));
+                    }
+                }
+            }
+
+            TCRYPT_UNROLL
+            for (size_t r = 0; r < R; r++)
+            {
+                TCRYPT_UNROLL
+                for (size_t v = 0; v < KV; v++)
+                {
+                    if constexpr (sizeof(T) == 8)
+                        lo[r][v] = _mm256_add_epi64(lo[r][v], _mm256_slli_epi64(cross[r][v], 32));
+
+                    _mm256_storeu_si256((__m256i*)(out[r].data() + k0 + v * V), lo[r][v]);
+                }
+            }
+        }
+
+        template <typename T, size_t n, size_t R, size_t KV> TCRYPT_TARGET("avx512f") void GemmTileAvx512(const std::array<T, n>* in, std::array<T, n>* out, const T* mt, size_t k0)
+        {
+            constexpr size_t V = 64 / sizeof(T);
+
+            __m512i lo[R][KV], cross[R][KV];
+
+            TCRYPT_UNROLL
+            for (size_t r = 0; r < R; r++)
+            {
+                TCRYPT_UNROLL
+                for (size_t v = 0; v < KV; v++)
+                    lo[r][v] = cross[r][v] = _mm512_setzero_si512();
+            }
+
+            for (size_t j = 0; j < n; j++)
+            {
+                __m512i b[KV], bh[KV];
+
+                TCRYPT_UNROLL
+                for (size_t v = 0; v < KV; v++)
+                {
+                    b[v] = _mm512_loadu_si512((const void*)(mt + j * n + k0 + v * V));
+
+                    if constexpr (sizeof(T) == 8)
+                        bh[v] = _mm512_maskz_srli_epi64(all_qwords, b[v], 32);
+                }
+
+                TCRYPT_UNROLL
+                for (size_t r = 0; r < R; r++)
+                {
+                    if constexpr (sizeof(T) == 8)
+                    {
+                        __m512i a = _mm512_set1_epi64((long long)in[r][j]);
+                        __m512i ah = _mm512_set1_epi64((long long)(in[r][j] >> 32));
+
+                        TCRYPT_UNROLL
+                        for (size_t v = 0; v < KV; v++)
+                        {
+                            lo[r][v] = _mm512_add_epi64(lo[r][v], _mm512_maskz_mul_epu32(all_qwords, a, b[v]));
+                            cross[r][v] = _mm512_add_epi64(cross[r][v], _mm512_add_epi64(_mm512_maskz_mul_epu32(all_qwords, ah, b[v]), _mm512_maskz_mul_epu32(all_qwords, a, bh[v])));
+                        }
+                    }
+                    else
+                    {
+                        __m512i a = _mm512_set1_epi32((int)in[r][j]);
+
+                        TCRYPT_UNROLL
+                        for (size_t v = 0; v < KV; v++)
+                            lo[r][v] = _mm512_add_epi32(lo[r][v], _mm512_mullo_epi32(a, b[v]));
+                    }
+                }
+            }
+
+            TCRYPT_UNROLL
+            for (size_t r = 0; r < R; r++)
+            {
+                TCRYPT_UNROLL
+                for (size_t v = 0; v < KV; v++)
+                {
+                    if constexpr (sizeof(T) == 8)
+                        lo[r][v] = _mm512_add_epi64(lo[r][v], _mm512_maskz_slli_epi64(all_qwords, cross[r][v], 32));
+
+                    _mm512_storeu_si512((void*)(out[r].data() + k0 + v * V), lo[r][v]);
+                }
+            }
+        }
+
+        // Panels of KV vectors of output coefficients, every tile of the chunk reuses the same panel of the transposed matrix.
+        // A panel is n rows of KV vectors, so for the widest blocks it outgrows L1 and is served from L2 with the chunk.
+        //
+
+        template <typename T, size_t n, size_t R, size_t KV, size_t V, typename TILE, typename TAIL> void GemmPanels(const std::array<T, n>* in, std::array<T, n>* out, size_t count, const T* mt, TILE&& tile, TAIL&& tail)
+        {
+            for (size_t k0 = 0; k0 < n; k0 += KV * V)
+            {
+                size_t b = 0;
+
+                for (; b + R <= count; b += R)
+                    tile(in + b, out + b, mt, k0);
+
+                for (; b < count; b++)
+                    tail(in + b, out + b, mt, k0);
+            }
+        }
+
+#endif
+
+        // Inverses of count odd words mod 2^w, for setting up many keys at once.
+        //
+
+        template <typename T> void InverseBatch(const T* in, T* out, size_t count)
+        {
+            size_t i = 0;
+
+#if TCRYPT_X86
+            if constexpr (lane_type<T>())
+            {
+                switch (cpu::Active())
+                {
+                case cpu::Kernel::Avx512:
+                    for (; i + 64 / sizeof(T) <= count; i += 64 / sizeof(T))
+                        InverseAvx512(in + i, out + i);
+                    [[fallthrough]];
+                case cpu::Kernel::Avx2:
+                    for (; i + 32 / sizeof(T) <= count; i += 32 / sizeof(T))
+                        InverseAvx2(in + i, out + i);
+                    [[fallthrough]];
+                case cpu::Kernel::Sse41:
+                    for (; i + 16 / sizeof(T) <= count; i += 16 / sizeof(T))
+                        InverseSse41(in + i, out + i);
+                    [[fallthrough]];
+                default:
+                    break;
+                }
+            }
+#endif
+
+            for (; i < count; i++)
+                out[i] = Inverse(in[i]);
+        }
+
+        template <typename T, size_t n, typename M> void Lanes(const std::array<T, n>* in, std::array<T, n>* out, size_t count, const M& m)
+        {
+            // One independent block per lane, each coefficient is broadcast to every lane.
+            // Wider kernels fall through to narrower ones for the remainder, in and out must not overlap.
+            //
+
+            size_t i = 0;
+
+#if TCRYPT_X86
+            if constexpr (lane_type<T>())
+            {
+                switch (cpu::Active())
+                {
+                case cpu::Kernel::Avx512:
+                    for (; i + 64 / sizeof(T) <= count; i += 64 / sizeof(T))
+                        LanesAvx512(in + i, out + i, m);
+                    [[fallthrough]];
+                case cpu::Kernel::Avx2:
+                    for (; i + 32 / sizeof(T) <= count; i += 32 / sizeof(T))
+                        LanesAvx2(in + i, out + i, m);
+                    [[fallthrough]];
+                case cpu::Kernel::Sse41:
+                    for (; i + 16 / sizeof(T) <= count; i += 16 / sizeof(T))
+                        LanesSse41(in + i, out + i, m);
+                    [[fallthrough]];
+                default:
+                    break;
+                }
+            }
+#endif
+
+            for (; i < count; i++)
+            {
+                for (size_t k = 0; k < n; k++)
+                {
+                    out[i][k] = 0;
+
+                    for (size_t j = 0; j < n; j++)
+                        out[i][k] += Product(m(k, j), in[i][j]);
+                }
+            }
+        }
+
+        // Decrypting a whole buffer is one matrix product, every block times the symmetry, so past gemm_threshold bytes
+        // decrypt::Long runs it as a blocked GEMM instead of a batch at a time.
+        // Blocks are taken gemm_chunk bytes at a time so a chunk and its output stay in L2 while the panels pass over it.
+        //
+
+        constexpr size_t gemm_threshold = 64 * 1024;
+        constexpr size_t gemm_chunk = 32 * 1024;
+
+        template <typename T, size_t n> constexpr bool gemm_shape()
+        {
+            return lane_type<T>() && n >= 16 && n % 16 == 0 && n < large_block_threshold;
+        }
+
+        // Vectors per panel, the most of cap that divide the row.
+        //
+
+        constexpr size_t gemm_panel(size_t vectors, size_t cap)
+        {
+            return (cap >= 4 && vectors % 4 == 0) ? 4 : (cap >= 2 && vectors % 2 == 0) ? 2 : 1;
+        }
+
+        inline bool GemmKernel()
+        {
+#if TCRYPT_X86
+            return cpu::Active() == cpu::Kernel::Avx512 || cpu::Active() == cpu::Kernel::Avx2;
+#else
+            return false;
+#endif
+        }
+
+        // mt[j * n + k] is coefficient j of row k, so one row of mt feeds a vector of outputs.
+        //
+
+        template <typename T, size_t n, typename ES> constexpr void TransposeFunction(const ES& es, T* mt)
+        {
+            FunctionRows<ES> m{ es, es.size() - n, n };
+
+            for (size_t k = 0; k < n; k++)
+            {
+                for (size_t j = 0; j < n; j++)
+                    mt[j * n + k] = m(k, j);
+            }
+        }
+
+        template <typename T, size_t n> void FunctionGemm(const std::array<T, n>* in, std::array<T, n>* out, size_t count, const T* mt)
+        {
+            static_assert(gemm_shape<T, n>(), "GEMM needs whole vectors of 32 or 64 bit words");
+
+#if TCRYPT_X86
+            if (cpu::Active() == cpu::Kernel::Avx512)
+            {
+                // 32 zmm registers, u32 holds 4 x 4 accumulators, u64 4 x 2 pairs of split accumulators.
+                //
+
+                constexpr size_t V = 64 / sizeof(T);
+                constexpr size_t KV = gemm_panel(n / V, (sizeof(T) == 8) ? 2 : 4);
+
+                GemmPanels<T, n, 4, KV, V>(in, out, count, mt, GemmTileAvx512<T, n, 4, KV>, GemmTileAvx512<T, n, 1, KV>);
+                return;
+            }
+
+            if (cpu::Active() == cpu::Kernel::Avx2)
+            {
+                // 16 ymm registers, u32 holds 4 x 2 accumulators, u64 2 x 2 pairs.
+                //
+
+                constexpr size_t V = 32 / sizeof(T);
+                constexpr size_t R = (sizeof(T) == 8) ? 2 : 4;
+                constexpr size_t KV = gemm_panel(n / V, 2);
+
+                GemmPanels<T, n, R, KV, V>(in, out, count, mt, GemmTileAvx2<T, n, R, KV>, GemmTileAvx2<T, n, 1, KV>);
+                return;
+            }
+#endif
+            for (size_t i = 0; i < count; i++)
+            {
+                for (size_t k = 0; k < n; k++)
+                {
+                    out[i][k] = 0;
+
+                    for (size_t j = 0; j < n; j++)
+                        out[i][k] += mt[j * n + k] * in[i][j];
+                }
+            }
+        }
+
+        template <typename T, size_t n, typename ES> void ToFunctionBatch(const std::array<T, n>* polynomials, std::array<T, n>* outputs, size_t count, const ES& es)
+        {
+            Lanes(polynomials, outputs, count, FunctionRows<ES>{ es, es.size() - n, n });
+        }
+
+        template <typename T, size_t n, typename FT> void ToFusedBatch(const std::array<T, n>* data, std::array<T, n>* outputs, size_t count, const FT& ft)
+        {
+            Lanes(data, outputs, count, FusedRows<FT>{ ft });
+        }
+
+        // Output at least this large would only evict the working set, so it is written around the cache.
+        //
+
+        constexpr size_t stream_threshold = 8 * 1024 * 1024;
+
+#if TCRYPT_X86
+
+        TCRYPT_TARGET("sse2") inline void StreamStore(uint8_t* dst, const uint8_t* src, size_t bytes)
+        {
+            size_t head = std::min((16 - (uintptr_t)dst % 16) % 16, bytes);
+
+            std::memcpy(dst, src, head);
+            dst += head; src += head; bytes -= head;
+
+            for (; bytes >= 16; dst += 16, src += 16, bytes -= 16)
+                _mm_stream_si128((__m128i*)dst, _mm_loadu_si128((const __m128i*)src));
+
+            std::memcpy(dst, src, bytes);
+        }
+
+#endif
+
+        inline void Store(uint8_t* dst, const void* src, size_t bytes, bool stream)
+        {
+#if TCRYPT_X86
+            if (stream)
+            {
+                StreamStore(dst, (const uint8_t*)src, bytes);
+                return;
+            }
+#endif
+            std::memcpy(dst, src, bytes);
+        }
+
+        inline void Fence(bool stream)
+        {
+#if TCRYPT_X86
+            if (stream)
+                _mm_sfence();
+#endif
+        }
+    }
+}
\ No newline at end of file
@@ -2,16 +2,19 @@
 
 #pragma once
 
-#include <chrono>
-#include <string_view>
+#include <sstream>
 
 #include "encrypt.hpp"
 #include "decrypt.hpp"
+#include "ctr.hpp"
+#include "container.hpp"
+#include "pipeline.hpp"
+#include "perf.hpp"
+#include "cache.hpp"
 #include "math.hpp"
 
 #include "d8u/memory.hpp"
 #include "d8u/random.hpp"
-#include "d8u/crypto.hpp"
 
 #include "hash/sse_int.hpp"
 
@@ -104,206 +107,719 @@ TEST_CASE("Encrypt Random", "[tcrypt::]")
     CHECK(std::equal(data.begin(), data.end(), original.begin()));
 }
 
-TEST_CASE("bench", "[tcrypt::]")
+TEST_CASE("Encrypt Tail", "[tcrypt::]")
+{
+    constexpr std::array<uint64_t, 4> key{ 73, 23, 63, 23 };
+    constexpr std::array<uint64_t, 4> iv{ 46, 47, 47, 85 };
+
+    template_crypto::encrypt::Long<uint64_t, 4> lec(key, iv);
+    template_crypto::decrypt::Long<uint64_t, 4> ldc(key, iv);
+
+    d8u::aligned_vector data{ 1,2,3,4,5,6,7,8,9,0,1,2,3,4,5,6,7,8,9,0,1,2,3,4,5,6,7,8,9,0,1,2,45,45,45 };
+    auto original = data;
+
+    lec.Encrypt(data);
+    ldc.Decrypt(data);
+
+    CHECK(std::equal(data.begin(), data.end(), original.begin()));
+}
+
+TEST_CASE("Encrypt Aligned", "[tcrypt::]")
 {
-    using namespace std::chrono;
+    constexpr std::array<uint64_t, 4> key{ 73, 23, 63, 23 };
+    constexpr std::array<uint64_t, 4> iv{ 46, 47, 47, 85 };
+
+    template_crypto::encrypt::Long<uint64_t, 4> lec(key, iv);
+    template_crypto::decrypt::Long<uint64_t, 4> ldc(key, iv);
+
+    d8u::aligned_vector data{ 1,2,3,4,5,6,7,8,9,0,1,2,3,4,5,6,7,8,9,0,1,2,3,4,5,6,7,8,9,0,1,2 };
+    auto original = data;
+
+    lec.Encrypt(data);
+    ldc.Decrypt(data);
+
+    CHECK(std::equal(data.begin(), data.end(), original.begin()));
+}
+
+template < typename T, size_t L > void test_fused(std::array<T, L> key)
+{
+    using namespace template_crypto::block;
+
+    EncodeContextLong2<T, L> reference(key);
+    EncodeContextFused<T, L> fused(key);
+
+    auto rv = d8u::random::Vector<uint8_t>(sizeof(T) * L * 64);
+    auto block_p = (std::array<T, L>*)rv.data();
+
+    std::array<T, L> scratch, r1, r2;
+
+    for (size_t i = 0; i < 64; i++, block_p++)
+    {
+        reference.Run(*block_p, scratch, r1);
+        fused.Run(*block_p, scratch, r2);
+
+        CHECK(r1 == r2);
+    }
+}
+
+TEST_CASE("Fused Transform", "[tcrypt::]")
+{
+    test_fused(std::array<uint8_t, 4> { 7, 5, 2, 9 });
+    test_fused(std::array<uint16_t, 6> { 73, 23, 63, 23, 63, 99 });
+    test_fused(std::array<uint32_t, 8> { 73, 23, 63, 23, 73, 23, 63, 23 });
+    test_fused(std::array<uint64_t, 4> { 73, 23, 63, 23 });
+    test_fused(std::array<uint64_t, 16> { 72, 23, 63, 23, 73, 23, 63, 23, 1, 2, 3, 4, 5, 6, 7, 8 });
+}
+
+template < typename T, size_t L > void test_series(std::array<T, L> key)
+{
+    using namespace template_crypto::math;
+
+    ElectiveTransform<T, L> et(key);
+    ElectiveTransform2<T, L> et2(key);
+
+    auto rv = d8u::random::Vector<uint8_t>(sizeof(T) * L * 64);
+    auto block_p = (std::array<T, L>*)rv.data();
+
+    std::array<T, L> r1, r2;
+
+    for (size_t i = 0; i < 64; i++, block_p++)
+    {
+        ToPolynomial(*block_p, r1, et);
+        ToPolynomial2(*block_p, r2, et2);
+
+        CHECK(r1 == r2);
+    }
+}
+
+TEST_CASE("Inverse Series", "[tcrypt::]")
+{
+    test_series(std::array<uint8_t, 5> { 6, 5, 2, 9, 1 });
+    test_series(std::array<uint16_t, 6> { 73, 23, 63, 23, 63, 99 });
+    test_series(std::array<uint32_t, 8> { 73, 23, 63, 23, 73, 23, 63, 23 });
+    test_series(std::array<uint64_t, 16> { 72, 23, 63, 23, 73, 23, 63, 23, 1, 2, 3, 4, 5, 6, 7, 8 });
+}
+
+template < typename T, size_t L > void test_additive()
+{
+    using namespace template_crypto::math;
+
+    static PascalTriangle<T, L> pt;
+
+    auto rv = d8u::random::Vector<uint8_t>(sizeof(T) * L * 64);
+    auto block_p = (std::array<T, L>*)rv.data();
+
+    std::array<T, L> r1, r2;
+
+    for (size_t i = 0; i < 64; i++, block_p++)
+    {
+        ToPascal(*block_p, r1, pt);
+        ToPascalAdditive(*block_p, r2);
+
+        CHECK(r1 == r2);
+    }
+}
+
+TEST_CASE("Additive Pascal", "[tcrypt::]")
+{
+    test_additive<uint8_t, 5>();
+    test_additive<uint16_t, 7>();
+    test_additive<uint32_t, 8>();
+    test_additive<uint64_t, 16>();
+    test_additive<uint64_t, 33>();
+}
+
+template < typename T, size_t L > void test_large()
+{
+    using namespace template_crypto::math;
+
+    auto kv = d8u::random::Vector<uint8_t>(sizeof(T) * L);
+    auto key = *(std::array<T, L>*)kv.data();
+
+    static ElectiveTransform2<T, L> et(key);
+    static ElectiveSymmetry<L, T, L> es(key);
+
+    auto rv = d8u::random::Vector<uint8_t>(sizeof(T) * L * 4);
+    auto block_p = (std::array<T, L>*)rv.data();
+
+    static std::array<T, L> r1, r2;
+
+    for (size_t i = 0; i < 4; i++, block_p++)
+    {
+        ToPolynomial2(*block_p, r1, et);
+        ToPolynomialLarge(*block_p, r2, et);
+
+        CHECK(r1 == r2);
+
+        ToFunction(*block_p, r1, es);
+        ToFunctionLarge(*block_p, r2, es);
+
+        CHECK(r1 == r2);
+    }
+}
+
+TEST_CASE("Large Block", "[tcrypt::]")
+{
+    test_large<uint16_t, 100>();
+    test_large<uint32_t, 257>();
+    test_large<uint64_t, 512>();
+
+    static std::array<uint64_t, 512> key{ 73, 23, 63, 23 }, iv{ 46, 47, 47, 85 };
+
+    template_crypto::encrypt::Long<uint64_t, 512> lec(key, iv);
+    template_crypto::decrypt::Long<uint64_t, 512> ldc(key, iv);
+
+    auto rv = d8u::random::Vector<uint8_t>(64 * 1024 + 17);
+
+    d8u::aligned_vector data(rv.begin(), rv.end());
+    auto original = data;
+
+    lec.Encrypt(data);
+    CHECK(!std::equal(data.begin(), data.end(), original.begin()));
+
+    ldc.Decrypt(data);
+    CHECK(std::equal(data.begin(), data.end(), original.begin()));
+}
+
+template < typename T, size_t L > void test_batch(std::array<T, L> key)
+{
+    using namespace template_crypto::math;
+    using namespace template_crypto::cpu;
+
+    ElectiveSymmetry<L, T, L> es(key);
+
+    auto rv = d8u::random::Vector<uint8_t>(sizeof(T) * L * 19);
+    auto block_p = (std::array<T, L>*)rv.data();
+
+    std::array<std::array<T, L>, 19> r1, r2;
+
+    for (size_t i = 0; i < r1.size(); i++)
+        ToFunction(block_p[i], r1[i], es);
+
+    for (auto k : { Kernel::Scalar, Kernel::Sse41, Kernel::Avx2, Kernel::Avx512 })
+    {
+        if (Select(k) != k)
+            continue;
+
+        template_crypto::simd::ToFunctionBatch(block_p, r2.data(), r2.size(), es);
+
+        CHECK(r1 == r2);
+    }
+
+    Select(Detect());
+}
+
+TEST_CASE("Function Batch", "[tcrypt::]")
+{
+    INFO("kernel " << template_crypto::cpu::Name(template_crypto::cpu::Active()));
+
+    test_batch(std::array<uint8_t, 5> { 6, 5, 2, 9, 1 });
+    test_batch(std::array<uint32_t, 8> { 73, 23, 63, 23, 73, 23, 63, 23 });
+    test_batch(std::array<uint32_t, 3> { 73, 23, 63 });
+    test_batch(std::array<uint64_t, 4> { 73, 23, 63, 23 });
+    test_batch(std::array<uint64_t, 16> { 72, 23, 63, 23, 73, 23, 63, 23, 1, 2, 3, 4, 5, 6, 7, 8 });
+}
+
+TEST_CASE("Counter Mode", "[tcrypt::]")
+{
+    constexpr std::array<uint64_t, 4> key{ 73, 23, 63, 23 };
+    constexpr std::array<uint64_t, 4> iv{ 46, 47, 47, 85 };
+
+    template_crypto::ctr::Long<uint64_t, 4> ctr(key, iv);
 
     auto rv = d8u::random::Vector<uint8_t>(1024 * 1024 + 17);
 
     d8u::aligned_vector data(rv.begin(), rv.end());
+    auto original = data;
+
+    ctr.Crypt(data);
+    CHECK(!std::equal(data.begin(), data.end(), original.begin()));
+
+    auto serial = data;
+
+    d8u::aligned_vector seek(original.begin() + 64 * 32, original.end());
+    ctr.Crypt(seek, 64);
+    CHECK(std::equal(seek.begin(), seek.end(), serial.begin() + 64 * 32));
+
+    data = original;
+    ctr.CryptParallel(data, 4, 64 * 1024);
+    CHECK(data == serial);
+
+    ctr.CryptParallel(data, 4, 64 * 1024);
+    CHECK(data == original);
+
+    // Successive counters carry into no other word here, so a bare E(iv + i) would step by the same E(1) every block.
+    //
+
+    std::array<std::array<uint64_t, 4>, 3> stream = {};
+    ctr.Crypt((uint8_t*)stream.data(), sizeof(stream), 0);
+
+    bool affine = true;
+
+    for (size_t j = 0; j < 4; j++)
+        affine = affine && stream[1][j] - stream[0][j] == stream[2][j] - stream[1][j];
+
+    CHECK(!affine);
+}
+
+TEST_CASE("Decrypt Parallel", "[tcrypt::]")
+{
+    constexpr std::array<uint32_t, 8> key{ 73, 23, 63, 23, 73, 23, 63, 23 };
+    constexpr std::array<uint32_t, 8> iv{ 46, 47, 47, 85, 2772, 252, 267, 236 };
+
+    template_crypto::encrypt::Long<uint32_t, 8> lec(key, iv);
+    template_crypto::decrypt::Long<uint32_t, 8> ldc(key, iv);
+
+    template_crypto::parallel::Pool pool(3);
+
+    for (size_t size : { 0, 17, 4096, 1024 * 1024 + 17 })
+    {
+        auto rv = d8u::random::Vector<uint8_t>(size);
+
+        d8u::aligned_vector data(rv.begin(), rv.end());
+        auto original = data;
+
+        lec.Encrypt(data);
 
-    constexpr auto reps = 1000;
+        auto threaded = data, pooled = data;
 
+        ldc.Decrypt(data);
+        ldc.DecryptParallel(threaded, 4, 1024);
+        ldc.DecryptParallel(pooled, pool, 4096);
 
-    d8u::transform::Password pw(std::string_view("testest"));
+        CHECK(data == original);
+        CHECK(threaded == original);
+        CHECK(pooled == original);
+    }
+}
 
+TEST_CASE("Multi Buffer", "[tcrypt::]")
+{
+    constexpr std::array<uint64_t, 4> key{ 73, 23, 63, 23 };
+
+    template_crypto::encrypt::MultiBuffer<uint64_t, 4, 8> mbe(key);
+
+    std::vector<d8u::aligned_vector> streams, expected;
+    std::vector<std::array<uint64_t, 4>> ivs;
+
+    for (size_t i = 0; i < 37; i++)
+    {
+        auto rv = d8u::random::Vector<uint8_t>((i * 7919) % 3000);
+
+        streams.emplace_back(rv.begin(), rv.end());
+        ivs.push_back({ i, i * 3, 47, 85 });
+
+        expected.push_back(streams.back());
+        template_crypto::encrypt::Long<uint64_t, 4>(key, ivs.back()).Encrypt(expected.back());
+    }
+
+    mbe.Encrypt(streams, ivs);
+
+    CHECK(streams == expected);
+}
+
+TEST_CASE("Encrypt Copy", "[tcrypt::]")
+{
     constexpr std::array<uint64_t, 4> key{ 73, 23, 63, 23 };
     constexpr std::array<uint64_t, 4> iv{ 46, 47, 47, 85 };
 
     template_crypto::encrypt::Long<uint64_t, 4> lec(key, iv);
     template_crypto::decrypt::Long<uint64_t, 4> ldc(key, iv);
 
-    constexpr std::array<uint64_t, 8> key2{ 73, 23, 63, 23,73, 23, 63, 23 };
-    constexpr std::array<uint64_t, 8> iv2{ 46, 47, 47, 85,2772, 252, 267, 236 };
+    for (size_t size : { 35, 1024 * 1024 + 17, 9 * 1024 * 1024 + 3 })
+    {
+        auto rv = d8u::random::Vector<uint8_t>(size);
 
-    template_crypto::encrypt::Long<uint64_t, 8> lec2(key2, iv2);
-    template_crypto::decrypt::Long<uint64_t, 8> ldc2(key2, iv2);
+        const d8u::aligned_vector original(rv.begin(), rv.end());
+        d8u::aligned_vector in_place = original, copy(size), plain(size);
 
-    //alignas(16) std::array<sse_int::pint128_t, 8> key3{ 73, 23, 63, 23,73, 23, 63, 23 };
-    //alignas(16) std::array<sse_int::pint128_t, 8> iv3{ 46, 47, 47, 85,2772, 252, 267, 236 };
+        lec.Encrypt(in_place);
+        lec.Encrypt(original, copy);
 
-    //alignas(16) template_crypto::encrypt::Long<sse_int::pint128_t, 8> lec3(key3, iv3);
-    //alignas(16) template_crypto::decrypt::Long<sse_int::pint128_t, 8> ldc3(key3, iv3);
+        CHECK(copy == in_place);
 
-    //alignas(16) std::array<sse_int::pint128_t, 4> key4{ 73, 23, 63, 23 };
-    //alignas(16) std::array<sse_int::pint128_t, 4> iv4{ 46, 47, 47, 85 };
+        ldc.Decrypt(copy, plain);
 
-    //alignas(16) template_crypto::encrypt::Long<sse_int::pint128_t, 4> lec4(key4, iv4);
-    //alignas(16) template_crypto::decrypt::Long<sse_int::pint128_t, 4> ldc4(key4, iv4);
+        CHECK(plain == original);
+    }
+}
 
-    //alignas(16) std::array<sse_int::pint128_t, 2> key5{ 73, 23 };
-    //alignas(16) std::array<sse_int::pint128_t, 2> iv5{ 46, 47 };
+TEST_CASE("Encrypt Stream", "[tcrypt::]")
+{
+    constexpr std::array<uint32_t, 8> key{ 73, 23, 63, 23, 73, 23, 63, 23 };
+    constexpr std::array<uint32_t, 8> iv{ 46, 47, 47, 85, 2772, 252, 267, 236 };
 
-    //alignas(16) template_crypto::encrypt::Long<sse_int::pint128_t, 2> lec5(key5, iv5);
-    //alignas(16) template_crypto::decrypt::Long<sse_int::pint128_t, 2> ldc5(key5, iv5);
+    using E = template_crypto::encrypt::Long<uint32_t, 8>;
+    using D = template_crypto::decrypt::Long<uint32_t, 8>;
 
-    constexpr std::array<uint32_t, 8> key6{ 73, 23, 63, 23,73, 23, 63, 23 };
-    constexpr std::array<uint32_t, 8> iv6{ 46, 47, 47, 85,2772, 252, 267, 236 };
+    E lec(key, iv);
+    D ldc(key, iv);
 
-    template_crypto::encrypt::Long<uint32_t, 8> lec6(key6, iv6);
-    template_crypto::decrypt::Long<uint32_t, 8> ldc6(key6, iv6);
+    auto rv = d8u::random::Vector<uint8_t>(100 * 1024 + 17);
 
+    const d8u::aligned_vector original(rv.begin(), rv.end());
+    d8u::aligned_vector expected = original, streamed(original.size() + E::block_bytes()), plain(streamed.size());
 
+    lec.Encrypt(expected);
 
-    high_resolution_clock::time_point t1 = high_resolution_clock::now();
+    E::Stream es(lec);
+    D::Stream ds(ldc);
 
-    for (size_t i = 0; i < reps; i++)
-        lec.Encrypt(data);
+    size_t in = 0, out = 0, back = 0;
 
-    high_resolution_clock::time_point t2 = high_resolution_clock::now();
+    for (size_t step = 1; in < original.size(); step = step * 3 % 1001)
+    {
+        size_t size = std::min(step, original.size() - in);
 
-    std::cout << "E1 " << std::chrono::duration_cast<std::chrono::microseconds>(t2.time_since_epoch() - t1.time_since_epoch()).count() << std::endl;
+        out += es.Update(original.data() + in, size, streamed.data() + out);
+        in += size;
+    }
 
+    out += es.Finalize(streamed.data() + out);
+    streamed.resize(out);
 
-    t1 = high_resolution_clock::now();
+    CHECK(streamed == expected);
 
-    for (size_t i = 0; i < reps; i++)
-        ldc.Decrypt(data);
+    for (size_t i = 0; i < streamed.size(); i += 333)
+        back += ds.Update(streamed.data() + i, std::min(size_t(333), streamed.size() - i), plain.data() + back);
 
-    t2 = high_resolution_clock::now();
+    back += ds.Finalize(plain.data() + back);
+    plain.resize(back);
 
-    std::cout << "D1 " << std::chrono::duration_cast<std::chrono::microseconds>(t2.time_since_epoch() - t1.time_since_epoch()).count() << std::endl;
+    CHECK(plain == original);
+}
+
+TEST_CASE("Decrypt Range", "[tcrypt::]")
+{
+    constexpr std::array<uint64_t, 4> key{ 73, 23, 63, 23 };
+    constexpr std::array<uint64_t, 4> iv{ 46, 47, 47, 85 };
 
+    template_crypto::encrypt::Long<uint64_t, 4> lec(key, iv);
+    template_crypto::decrypt::Long<uint64_t, 4> ldc(key, iv);
 
+    auto rv = d8u::random::Vector<uint8_t>(4096 + 17);
 
-    t1 = high_resolution_clock::now();
+    const d8u::aligned_vector original(rv.begin(), rv.end());
+    d8u::aligned_vector ciphertext = original;
 
-    for (size_t i = 0; i < reps; i++)
-        lec2.Encrypt(data);
+    lec.Encrypt(ciphertext);
 
-    t2 = high_resolution_clock::now();
+    for (auto range : { std::pair<size_t, size_t>{ 0, 1 }, { 0, 4113 }, { 31, 2 }, { 32, 32 }, { 1000, 777 }, { 4090, 23 }, { 4100, 13 }, { 4112, 1 } })
+    {
+        d8u::aligned_vector out(range.second);
 
-    std::cout << "E2 " << std::chrono::duration_cast<std::chrono::microseconds>(t2.time_since_epoch() - t1.time_since_epoch()).count() << std::endl;
+        CHECK(ldc.DecryptRange(ciphertext, range.first, range.second, out) == range.second);
 
+        CHECK(std::equal(out.begin(), out.end(), original.begin() + range.first));
+    }
 
-    t1 = high_resolution_clock::now();
+    // Ranges past the end are cut short or empty, and an out too small for the cut range is a contract violation.
+    //
 
-    for (size_t i = 0; i < reps; i++)
-        ldc2.Decrypt(data);
+    d8u::aligned_vector out(64);
 
-    t2 = high_resolution_clock::now();
+    CHECK(ldc.DecryptRange(ciphertext, 4100, 64, out) == 13);
+    CHECK(std::equal(out.begin(), out.begin() + 13, original.begin() + 4100));
 
-    std::cout << "D2 " << std::chrono::duration_cast<std::chrono::microseconds>(t2.time_since_epoch() - t1.time_since_epoch()).count() << std::endl;
+    CHECK(ldc.DecryptRange(ciphertext, 4113, 1, out) == 0);
+    CHECK(ldc.DecryptRange(ciphertext, size_t(-1), 2, out) == 0);
+    CHECK_THROWS_AS(ldc.DecryptRange(ciphertext, 1, size_t(-1), out), gsl::fail_fast);
+    CHECK_THROWS_AS(ldc.DecryptRange(ciphertext, 0, 65, out), gsl::fail_fast);
+    CHECK(ldc.DecryptRange(ciphertext, 4049, 65, out) == 64);
+}
 
+TEST_CASE("Ciphertext Stealing", "[tcrypt::]")
+{
+    constexpr std::array<uint64_t, 4> key{ 73, 23, 63, 23 };
+    constexpr std::array<uint64_t, 4> iv{ 46, 47, 47, 85 };
 
+    using E = template_crypto::encrypt::Long<uint64_t, 4, true>;
+    using D = template_crypto::decrypt::Long<uint64_t, 4, true>;
 
+    E lec(key, iv);
+    D ldc(key, iv);
 
-    /*t1 = high_resolution_clock::now();
+    template_crypto::encrypt::Long<uint64_t, 4> mask(key, iv);
 
-    for (size_t i = 0; i < reps; i++)
-        lec3.Encrypt(data);
+    for (size_t size : { 0, 5, 32, 33, 63, 64, 100, 4096 + 17 })
+    {
+        auto rv = d8u::random::Vector<uint8_t>(size);
 
-    t2 = high_resolution_clock::now();
+        const d8u::aligned_vector original(rv.begin(), rv.end());
+        d8u::aligned_vector ciphertext = original, masked = original, plain;
 
-    std::cout << "E3 " << std::chrono::duration_cast<std::chrono::microseconds>(t2.time_since_epoch() - t1.time_since_epoch()).count() << std::endl;
+        lec.Encrypt(ciphertext);
+        mask.Encrypt(masked);
 
+        // Only messages with a tail behind a whole block differ from the masked form.
+        //
 
-    t1 = high_resolution_clock::now();
+        CHECK((ciphertext == masked) == (size < E::block_bytes() || size % E::block_bytes() == 0));
 
-    for (size_t i = 0; i < reps; i++)
-        ldc3.Decrypt(data);
+        plain = ciphertext;
+        ldc.Decrypt(plain);
+        CHECK(plain == original);
 
-    t2 = high_resolution_clock::now();
+        plain = ciphertext;
+        ldc.DecryptParallel(plain, 4, 64);
+        CHECK(plain == original);
 
-    std::cout << "D3 " << std::chrono::duration_cast<std::chrono::microseconds>(t2.time_since_epoch() - t1.time_since_epoch()).count() << std::endl;
+        for (size_t offset = 0; offset < size; offset += 29)
+        {
+            d8u::aligned_vector out(std::min(size_t(40), size - offset));
 
+            CHECK(ldc.DecryptRange(ciphertext, offset, out.size(), out) == out.size());
 
-    t1 = high_resolution_clock::now();
+            CHECK(std::equal(out.begin(), out.end(), original.begin() + offset));
+        }
 
-    for (size_t i = 0; i < reps; i++)
-        lec4.Encrypt(data);
+        E::Stream es(lec);
+        D::Stream ds(ldc);
 
-    t2 = high_resolution_clock::now();
+        d8u::aligned_vector streamed(size + 2 * E::block_bytes()), back(size + 2 * E::block_bytes());
+        size_t out = 0, in = 0;
 
-    std::cout << "E4 " << std::chrono::duration_cast<std::chrono::microseconds>(t2.time_since_epoch() - t1.time_since_epoch()).count() << std::endl;
+        for (size_t i = 0; i < size; i += 7)
+            out += es.Update(original.data() + i, std::min(size_t(7), size - i), streamed.data() + out);
 
+        out += es.Finalize(streamed.data() + out);
+        streamed.resize(out);
 
-    t1 = high_resolution_clock::now();
+        CHECK(streamed == ciphertext);
 
-    for (size_t i = 0; i < reps; i++)
-        ldc4.Decrypt(data);
+        for (size_t i = 0; i < size; i += 11)
+            in += ds.Update(ciphertext.data() + i, std::min(size_t(11), size - i), back.data() + in);
 
-    t2 = high_resolution_clock::now();
+        in += ds.Finalize(back.data() + in);
+        back.resize(in);
 
-    std::cout << "D4 " << std::chrono::duration_cast<std::chrono::microseconds>(t2.time_since_epoch() - t1.time_since_epoch()).count() << std::endl;
+        CHECK(back == original);
+    }
 
+    template_crypto::encrypt::MultiBuffer<uint64_t, 4, 8, true> mbe(key);
 
+    std::vector<d8u::aligned_vector> streams, expected;
+    std::vector<std::array<uint64_t, 4>> ivs;
 
-    t1 = high_resolution_clock::now();
+    for (size_t i = 0; i < 37; i++)
+    {
+        auto rv = d8u::random::Vector<uint8_t>((i * 7919) % 3000);
 
-    for (size_t i = 0; i < reps; i++)
-        lec5.Encrypt(data);
+        streams.emplace_back(rv.begin(), rv.end());
+        ivs.push_back({ i, i * 3, 47, 85 });
 
-    t2 = high_resolution_clock::now();
+        expected.push_back(streams.back());
+        E(key, ivs.back()).Encrypt(expected.back());
+    }
 
-    std::cout << "E5 " << std::chrono::duration_cast<std::chrono::microseconds>(t2.time_since_epoch() - t1.time_since_epoch()).count() << std::endl;
+    mbe.Encrypt(streams, ivs);
 
+    CHECK(streams == expected);
+}
 
-    t1 = high_resolution_clock::now();
+TEST_CASE("Authenticated", "[tcrypt::]")
+{
+    constexpr std::array<uint32_t, 8> key{ 73, 23, 63, 23, 73, 23, 63, 23 };
+    constexpr std::array<uint32_t, 8> iv{ 46, 47, 47, 85, 2772, 252, 267, 236 };
+    constexpr std::array<uint32_t, 8> iv2{ 46, 47, 47, 85, 2772, 252, 267, 237 };
 
-    for (size_t i = 0; i < reps; i++)
-        ldc5.Decrypt(data);
+    template_crypto::encrypt::Authenticated<uint32_t, 8> aec(key, iv);
+    template_crypto::decrypt::Authenticated<uint32_t, 8> adc(key, iv);
+    template_crypto::encrypt::Long<uint32_t, 8> lec(key, iv);
 
-    t2 = high_resolution_clock::now();
+    for (size_t size : { 0, 3, 32, 45, 4096 + 17 })
+    {
+        auto rv = d8u::random::Vector<uint8_t>(size);
 
-    std::cout << "D5 " << std::chrono::duration_cast<std::chrono::microseconds>(t2.time_since_epoch() - t1.time_since_epoch()).count() << std::endl;*/
+        const d8u::aligned_vector original(rv.begin(), rv.end());
+        d8u::aligned_vector ciphertext = original, plain = original, copy(size);
 
-    t1 = high_resolution_clock::now();
+        auto tag = aec.Encrypt(ciphertext);
 
-    for (size_t i = 0; i < reps; i++)
-        lec6.Encrypt(data);
+        // The ciphertext itself is unchanged from the plain mode.
+        //
 
-    t2 = high_resolution_clock::now();
+        lec.Encrypt(plain);
+        CHECK(plain == ciphertext);
 
-    std::cout << "E6 " << std::chrono::duration_cast<std::chrono::microseconds>(t2.time_since_epoch() - t1.time_since_epoch()).count() << std::endl;
+        CHECK(aec.Encrypt(original, copy) == tag);
 
+        if (size)
+        {
+            d8u::aligned_vector short_dst(size - 1);
 
-    t1 = high_resolution_clock::now();
+            CHECK_THROWS_AS(aec.Encrypt(original, short_dst), gsl::fail_fast);
+            CHECK_THROWS_AS(adc.Decrypt(ciphertext, short_dst, tag), gsl::fail_fast);
+        }
+        CHECK(template_crypto::encrypt::Authenticated<uint32_t, 8>(key, iv2).Encrypt(plain = original) != tag);
 
-    for (size_t i = 0; i < reps; i++)
-        ldc6.Decrypt(data);
+        CHECK(adc.Decrypt(ciphertext, plain, tag));
+        CHECK(plain == original);
 
-    t2 = high_resolution_clock::now();
+        auto forged = tag;
+        forged[5] ^= 1;
 
-    std::cout << "D6 " << std::chrono::duration_cast<std::chrono::microseconds>(t2.time_since_epoch() - t1.time_since_epoch()).count() << std::endl;
+        CHECK(!adc.Decrypt(plain = ciphertext, forged));
 
+        if (size)
+        {
+            CHECK(std::all_of(plain.begin(), plain.end(), [](uint8_t b) { return b == 0; }));
 
+            for (size_t i = 0; i < size; i += 1 + size / 7)
+            {
+                plain = ciphertext;
+                plain[i] ^= 0x10;
 
-    t1 = high_resolution_clock::now();
+                CHECK(!adc.Decrypt(plain, tag));
+            }
+        }
 
-    for (size_t i = 0; i < reps; i++)
-        d8u::transform::encrypt(data, pw);
+        CHECK(adc.Decrypt(ciphertext, tag));
+        CHECK(ciphertext == original);
+    }
 
-    t2 = high_resolution_clock::now();
+    // The eight limb steps agree with one limb at a time, so the split of the input does not matter.
+    //
 
-    std::cout << "AES256 " << (t2.time_since_epoch() - t1.time_since_epoch()).count() / 1000 << std::endl;
+    auto bytes = d8u::random::Vector<uint8_t>(301);
+    template_crypto::mac::Polynomial whole(12345), split(12345);
 
+    whole.Update(bytes.data(), bytes.size());
 
-    t1 = high_resolution_clock::now();
+    for (size_t i = 0; i < bytes.size(); i++)
+        split.Update(bytes.data() + i, 1);
 
-    for (size_t i = 0; i < reps; i++)
-        d8u::transform::decrypt(data, pw);
+    CHECK(whole.Finalize(bytes.size()) == split.Finalize(bytes.size()));
 
-    t2 = high_resolution_clock::now();
+    template_crypto::encrypt::Authenticated<uint32_t, 8, true> sec(key, iv);
+    template_crypto::decrypt::Authenticated<uint32_t, 8, true> sdc(key, iv);
 
-    std::cout << "AES256 " << (t2.time_since_epoch() - t1.time_since_epoch()).count() / 1000 << std::endl;
+    auto rv = d8u::random::Vector<uint8_t>(1000);
+    d8u::aligned_vector data(rv.begin(), rv.end()), original = data;
 
+    auto tag = sec.Encrypt(data);
 
-    CHECK(true);
+    CHECK(sdc.Decrypt(data, tag));
+    CHECK(data == original);
 }
 
+TEST_CASE("Container", "[tcrypt::]")
+{
+    constexpr std::array<uint64_t, 4> key{ 73, 23, 63, 23 };
+    constexpr std::array<uint64_t, 4> iv{ 46, 47, 47, 85 };
 
-TEST_CASE("Encrypt Tail", "[tcrypt::]")
+    using C = template_crypto::container::Long<uint64_t, 4>;
+
+    C lc(key, iv);
+
+    constexpr size_t chunk = 64 * 1024;
+
+    for (size_t size : { size_t(0), size_t(17), chunk, 3 * chunk + 1005 })
+    {
+        auto rv = d8u::random::Vector<uint8_t>(size);
+
+        const d8u::aligned_vector original(rv.begin(), rv.end());
+        d8u::aligned_vector serial(C::Size(size, chunk)), threaded(C::Size(size, chunk)), plain(size);
+
+        CHECK(lc.Encrypt(original, serial, chunk, 1) == serial.size());
+        CHECK(lc.Encrypt(original, threaded, chunk, 4) == threaded.size());
+        CHECK(serial == threaded);
+
+        CHECK(C::PayloadSize(serial) == size);
+        CHECK(C::ChunkCount(serial) == C::Chunks(size, chunk));
+
+        CHECK(lc.Decrypt(serial, plain, 4));
+        CHECK(plain == original);
+
+        // Each chunk opens on its own.
+        //
+
+        for (size_t c = 0; c < C::ChunkCount(serial); c++)
+        {
+            d8u::aligned_vector part(chunk);
+
+            size_t length = lc.DecryptChunk(serial, c, part);
+
+            CHECK(length == std::min(chunk, size - c * chunk));
+            CHECK(std::equal(part.begin(), part.begin() + length, original.begin() + c * chunk));
+        }
+
+        d8u::aligned_vector part(chunk);
+        CHECK(lc.DecryptChunk(serial, C::ChunkCount(serial), part) == 0);
+    }
+
+    auto rv = d8u::random::Vector<uint8_t>(2 * chunk);
+
+    const d8u::aligned_vector original(rv.begin(), rv.end());
+    d8u::aligned_vector framed(C::Size(original.size(), chunk)), plain(original.size());
+
+    lc.Encrypt(original, framed, chunk);
+
+    // Equal chunks still encrypt differently under their own ivs.
+    //
+
+    d8u::aligned_vector zeros(2 * chunk), zeros_framed(C::Size(zeros.size(), chunk));
+    lc.Encrypt(zeros, zeros_framed, chunk);
+
+    CHECK(!std::equal(zeros_framed.end() - chunk, zeros_framed.end(), zeros_framed.end() - 2 * chunk));
+
+    // The first block of a zero chunk is E(chunk iv), linear in the iv, so affine ivs would show as equal steps.
+    //
+
+    d8u::aligned_vector zeros3(3 * chunk), zeros3_framed(C::Size(zeros3.size(), chunk));
+    lc.Encrypt(zeros3, zeros3_framed, chunk);
+
+    auto first = [&](size_t c)
+    {
+        std::array<uint64_t, 4> b;
+        std::memcpy(b.data(), zeros3_framed.data() + C::Size(zeros3.size(), chunk) - zeros3.size() + c * chunk, sizeof(b));
+        return b;
+    };
+
+    bool affine = true;
+
+    for (size_t j = 0; j < 4; j++)
+        affine = affine && first(1)[j] - first(0)[j] == first(2)[j] - first(1)[j];
+
+    CHECK(!affine);
+
+    auto damaged = framed;
+    damaged[0] = 'X';
+    CHECK(!lc.Decrypt(damaged, plain));
+
+    damaged = framed;
+    damaged.resize(framed.size() - 1);
+    CHECK(!lc.Decrypt(damaged, plain));
+    CHECK(std::all_of(plain.begin(), plain.end(), [](uint8_t b) { return b == 0; }));
+
+    // A forged payload size near 2^64 must not wrap the chunk count into agreement.
+    //
+
+    damaged = framed;
+    uint64_t forged = ~uint64_t(0), forged_chunks = C::Chunks(size_t(forged), chunk);
+    std::memcpy(damaged.data() + 16, &forged, sizeof(forged));
+    std::memcpy(damaged.data() + 24, &forged_chunks, sizeof(forged_chunks));
+    CHECK(C::PayloadSize(damaged) == 0);
+    CHECK(!lc.Decrypt(damaged, plain));
+
+    // Undersized outputs and a zero chunk are refused before anything is written.
+    //
+
+    d8u::aligned_vector small(original.size() - 1), part(chunk - 1);
+
+    CHECK(!lc.Decrypt(framed, small));
+    CHECK(std::all_of(small.begin(), small.end(), [](uint8_t b) { return b == 0; }));
+    CHECK(lc.DecryptChunk(framed, 0, part) == 0);
+
+    d8u::aligned_vector short_framed(framed.size() - 1);
+
+    CHECK(lc.Encrypt(original, short_framed, chunk) == 0);
+    CHECK(lc.Encrypt(original, framed, 0) == 0);
+    CHECK(C::Chunks(original.size(), 0) == 0);
+    CHECK(std::all_of(short_framed.begin(), short_framed.end(), [](uint8_t b) { return b == 0; }));
+}
+
+TEST_CASE("Pipeline", "[tcrypt::]")
 {
     constexpr std::array<uint64_t, 4> key{ 73, 23, 63, 23 };
     constexpr std::array<uint64_t, 4> iv{ 46, 47, 47, 85 };
@@ -311,28 +827,591 @@ TEST_CASE("Encrypt Tail", "[tcrypt::]")
     template_crypto::encrypt::Long<uint64_t, 4> lec(key, iv);
     template_crypto::decrypt::Long<uint64_t, 4> ldc(key, iv);
 
-    d8u::aligned_vector data{ 1,2,3,4,5,6,7,8,9,0,1,2,3,4,5,6,7,8,9,0,1,2,3,4,5,6,7,8,9,0,1,2,45,45,45 };
-    auto original = data;
+    auto descriptor = [](FILE* f)
+    {
+#if defined(_WIN32)
+        return _fileno(f);
+#else
+        return fileno(f);
+#endif
+    };
+
+    auto contents = [](FILE* f)
+    {
+        d8u::aligned_vector data;
+        uint8_t buffer[4096];
 
-    lec.Encrypt(data);
-    ldc.Decrypt(data);
+        std::fseek(f, 0, SEEK_SET);
 
-    CHECK(std::equal(data.begin(), data.end(), original.begin()));
+        for (size_t r; (r = std::fread(buffer, 1, sizeof(buffer), f)) != 0;)
+            data.insert(data.end(), buffer, buffer + r);
+
+        return data;
+    };
+
+    auto rv = d8u::random::Vector<uint8_t>(3 * 64 * 1024 + 333);
+    const d8u::aligned_vector original(rv.begin(), rv.end());
+
+    d8u::aligned_vector expected = original;
+    lec.Encrypt(expected);
+
+    FILE* plain = std::tmpfile();
+    FILE* cipher = std::tmpfile();
+    FILE* back = std::tmpfile();
+
+    std::fwrite(original.data(), 1, original.size(), plain);
+    std::fflush(plain);
+    std::fseek(plain, 0, SEEK_SET);
+
+    auto stats = template_crypto::pipeline::Run(lec, descriptor(plain), descriptor(cipher), 64 * 1024, 3);
+
+    CHECK(stats.ok);
+    CHECK(stats.read.bytes == original.size());
+    CHECK(stats.write.bytes == original.size());
+    CHECK(contents(cipher) == expected);
+
+    std::fseek(cipher, 0, SEEK_SET);
+
+    stats = template_crypto::pipeline::Run(ldc, descriptor(cipher), descriptor(back), 64 * 1024, 2);
+
+    CHECK(stats.ok);
+    CHECK(contents(back) == original);
+
+    std::fclose(plain);
+    std::fclose(cipher);
+    std::fclose(back);
+
+#if defined(__linux__)
+
+    // The writer fails on a full device while the reader waits on a pipe that never closes, Run must still return.
+    //
+
+    int ends[2];
+    REQUIRE(pipe(ends) == 0);
+
+    CHECK(write(ends[1], original.data(), 4096) == 4096);
+
+    FILE* full = std::fopen("/dev/full", "wb");
+
+    if (full)
+    {
+        stats = template_crypto::pipeline::Run(lec, ends[0], descriptor(full), 4096, 2);
+
+        CHECK(!stats.ok);
+
+        std::fclose(full);
+    }
+
+    close(ends[0]);
+    close(ends[1]);
+
+#endif
 }
 
-TEST_CASE("Encrypt Aligned", "[tcrypt::]")
+TEST_CASE("Perf Counters", "[tcrypt::]")
 {
+    using namespace template_crypto;
+
     constexpr std::array<uint64_t, 4> key{ 73, 23, 63, 23 };
     constexpr std::array<uint64_t, 4> iv{ 46, 47, 47, 85 };
 
-    template_crypto::encrypt::Long<uint64_t, 4> lec(key, iv);
-    template_crypto::decrypt::Long<uint64_t, 4> ldc(key, iv);
+    encrypt::Long<uint64_t, 4> lec(key, iv);
 
-    d8u::aligned_vector data{ 1,2,3,4,5,6,7,8,9,0,1,2,3,4,5,6,7,8,9,0,1,2,3,4,5,6,7,8,9,0,1,2 };
-    auto original = data;
+    auto rv = d8u::random::Vector<uint8_t>(64 * 1024);
+
+    perf::Reset();
+
+    {
+        perf::Scope scope(perf::Region::EncryptLoop);
+        lec.Encrypt(rv);
+    }
+
+    auto& totals = perf::Summary()[(size_t)perf::Region::EncryptLoop];
+
+    CHECK(totals.calls >= 1);
+
+    if (perf::Group::This().available())
+        CHECK(totals.counts[perf::Instructions] > 0);
+
+    std::ostringstream report;
+    perf::Report(report);
+
+    CHECK(report.str().find("encrypt loop") != std::string::npos);
+
+    {
+        perf::Scope scope(perf::Region::DecodeRun, false);
+    }
+
+    CHECK(perf::Summary()[(size_t)perf::Region::DecodeRun].calls == 0);
+
+    // Multiplexing raised the running share between the samples, scaling each total on its own would give 115 - 200.
+    //
+
+    perf::Sample start, end;
+
+    start.counts[perf::Cycles] = 100; start.enabled = 100; start.running = 50;
+    end.counts[perf::Cycles] = 110; end.enabled = 200; end.running = 190;
+
+    CHECK(perf::Group::Delta(start, end)[perf::Cycles] == 7);
+    CHECK(perf::Group::Delta(start, start)[perf::Cycles] == 0);
+
+    perf::Reset();
+
+    CHECK(perf::Summary()[(size_t)perf::Region::EncryptLoop].calls == 0);
+}
+
+TEST_CASE("Shared Key", "[tcrypt::]")
+{
+    using namespace template_crypto;
+
+    constexpr std::array<uint32_t, 8> key{ 73, 23, 63, 23, 11, 5, 99, 7 };
+    constexpr std::array<uint32_t, 8> iv{ 46, 47, 47, 85, 3, 8, 13, 21 };
+
+    const encrypt::Long<uint32_t, 8, true> lec(key, iv);
+    const decrypt::Long<uint32_t, 8, true> ldc(key, iv);
+
+    constexpr size_t threads = 8;
+
+    std::vector<d8u::aligned_vector> original(threads), expected(threads), work(threads);
+
+    for (size_t t = 0; t < threads; t++)
+    {
+        auto rv = d8u::random::Vector<uint8_t>(64 * 1024 + 13 * t);
+
+        original[t].assign(rv.begin(), rv.end());
+        expected[t] = original[t];
+
+        lec.Encrypt(expected[t]);
+        work[t] = original[t];
+    }
+
+    std::vector<std::thread> workers;
+
+    for (size_t t = 0; t < threads; t++)
+    {
+        workers.emplace_back([&, t]()
+        {
+            for (size_t r = 0; r < 16; r++)
+            {
+                lec.Encrypt(work[t]);
+
+                if (work[t] != expected[t])
+                    return;
+
+                ldc.Decrypt(work[t]);
+            }
+        });
+    }
+
+    for (auto& w : workers)
+        w.join();
+
+    for (size_t t = 0; t < threads; t++)
+        CHECK(work[t] == original[t]);
+}
+
+TEST_CASE("Key Cache", "[tcrypt::]")
+{
+    using namespace template_crypto;
+
+    using Encrypt = encrypt::Long<uint64_t, 4>;
+    using Decrypt = decrypt::Long<uint64_t, 4>;
+
+    cache::Cache<Encrypt> encrypts(4 * sizeof(Encrypt), 1);
+    cache::Cache<Decrypt> decrypts;
+
+    auto rv = d8u::random::Vector<uint8_t>(4096 + 5);
+    const d8u::aligned_vector original(rv.begin(), rv.end());
+
+    auto key_of = [](uint64_t k) { return std::array<uint64_t, 4>{ 73 + k, 23, 63 + 2 * k, 23 }; };
+    constexpr std::array<uint64_t, 4> iv{ 46, 47, 47, 85 };
+
+    // Schedules are cached per key, each message brings its own iv.
+    //
+
+    for (uint64_t k = 0; k < 8; k++)
+    {
+        auto lec = encrypts.Get(key_of(k));
+        auto ldc = decrypts.Get(key_of(k));
+
+        CHECK(lec == encrypts.Get(key_of(k)));
+
+        d8u::aligned_vector data = original, expected = original;
+
+        lec->Encrypt(data.data(), data.data(), data.size(), iv);
+        Encrypt(key_of(k), iv).Encrypt(expected);
+
+        CHECK(data == expected);
+
+        ldc->Decrypt(data.data(), data.data(), data.size(), iv);
+
+        CHECK(data == original);
+    }
+
+    auto stats = encrypts.Metrics();
+
+    CHECK(stats.misses == 8);
+    CHECK(stats.hits == 8);
+    CHECK(stats.evictions == 4);
+    CHECK(stats.entries == 4);
+    CHECK(stats.bytes <= 4 * sizeof(Encrypt));
+
+    // An evicted schedule stays usable while it is held.
+    //
+
+    auto held = encrypts.Get(key_of(0));
+
+    CHECK(encrypts.Metrics().misses == 9);
+
+    encrypts.Clear();
+
+    CHECK(encrypts.Metrics().entries == 0);
+
+    d8u::aligned_vector data = original;
+    held->Encrypt(data.data(), data.data(), data.size(), iv);
+    decrypts.Get(key_of(0))->Decrypt(data.data(), data.data(), data.size(), iv);
+
+    CHECK(data == original);
+
+    std::atomic<size_t> found(0);
+
+    parallel::For(64, 8, [&](size_t i)
+    {
+        if (decrypts.Get(key_of(i % 12)))
+            found++;
+    });
+
+    CHECK(found == 64);
+
+    CHECK(decrypts.Metrics().hits + decrypts.Metrics().misses == 8 + 1 + 64);
+}
+
+template <typename T, size_t side> void constexpr_schedule(const std::array<T, side>& key)
+{
+    using namespace template_crypto::block;
+
+    EncodeContext<T, side> ec(key);
+    DecodeContextShort<T, side> dc(key);
+
+    std::array<T, side> x, c, p;
+
+    for (size_t i = 0; i < side; i++)
+        x[i] = T(31 * i + 5);
+
+    ec.Run(&x, &c, 1);
+    dc.Run(&c, &p, 1);
+
+    CHECK(p == x);
+}
+
+TEST_CASE("Constexpr Schedule", "[tcrypt::]")
+{
+    using namespace template_crypto;
+
+    static_assert(uint8_t(math::Inverse<uint8_t>(3) * 3) == 1);
+    static_assert(uint16_t(math::Inverse<uint16_t>(65535) * 65535u) == 1);
+    static_assert(math::Inverse<uint32_t>(0x12345679u) * 0x12345679u == 1);
+    static_assert(math::Inverse<uint64_t>(0x9e3779b97f4a7c15ull) * 0x9e3779b97f4a7c15ull == 1);
+#if defined(__SIZEOF_INT128__)
+    static_assert(math::Inverse<unsigned __int128>(0x9e3779b97f4a7c15ull) * 0x9e3779b97f4a7c15ull == 1);
+#endif
+
+    // The whole schedule folds to constants, the objects below need no code at startup.
+    //
+
+    static constexpr std::array<uint64_t, 4> key{ 73, 23, 63, 23 };
+    static constexpr std::array<uint64_t, 4> iv{ 46, 47, 47, 85 };
+
+    static constexpr block::EncodeContext<uint64_t, 4> ec(key);
+    static constexpr block::DecodeContextShort<uint64_t, 4> dc(key);
+
+    static_assert(ec.Transform()[0][0] != 0);
+    static_assert(dc.Symmetry()[0][0] == 73);
+
+    static constexpr std::array<uint16_t, 8> key16{ 0xfffe, 0xff00, 3, 9, 0x8001, 77, 0xffff, 12 };
+    static constexpr block::EncodeContext<uint16_t, 8> ec16(key16);
+    static constexpr block::DecodeContextShort<uint16_t, 8> dc16(key16);
+
+    static constexpr std::array<uint8_t, 16> key8{ 200, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 255 };
+    static constexpr block::EncodeContext<uint8_t, 16> ec8(key8);
+
+    static_assert(ec8.Transform()[15][15] != 0 || ec8.Transform()[15][0] != 0);
+
+    constexpr_schedule(key);
+    constexpr_schedule(key16);
+    constexpr_schedule(key8);
+
+    std::array<uint16_t, 8> x, c, p;
+
+    for (size_t i = 0; i < 8; i++)
+        x[i] = uint16_t(1000 * i + 1);
+
+    ec16.Run(&x, &c, 1);
+    dc16.Run(&c, &p, 1);
+
+    CHECK(p == x);
+
+#if defined(__cpp_constinit)
+    static constinit const encrypt::Long<uint64_t, 4> lec(key, iv);
+    static constinit const decrypt::Long<uint64_t, 4> ldc(key, iv);
+
+    auto rv = d8u::random::Vector<uint8_t>(4096 + 7);
+    const d8u::aligned_vector original(rv.begin(), rv.end());
+
+    d8u::aligned_vector data = original, expected = original;
 
     lec.Encrypt(data);
+    encrypt::Long<uint64_t, 4>(key, iv).Encrypt(expected);
+
+    CHECK(data == expected);
+
     ldc.Decrypt(data);
 
-    CHECK(std::equal(data.begin(), data.end(), original.begin()));
-}
\ No newline at end of file
+    CHECK(data == original);
+#endif
+}
+
+template <typename T> void test_inverse(size_t count)
+{
+    using namespace template_crypto;
+    using namespace template_crypto::cpu;
+
+    auto rv = d8u::random::Vector<uint8_t>(sizeof(T) * count);
+    std::vector<T> in(count), expected(count), out(count);
+
+    std::memcpy(in.data(), rv.data(), rv.size());
+
+    for (size_t i = 0; i < count; i++)
+    {
+        in[i] |= T(1);
+        expected[i] = math::Inverse(in[i]);
+
+        CHECK(T(in[i] * expected[i]) == T(1));
+    }
+
+    for (auto k : { Kernel::Scalar, Kernel::Sse41, Kernel::Avx2, Kernel::Avx512 })
+    {
+        if (Select(k) != k)
+            continue;
+
+        std::fill(out.begin(), out.end(), T(0));
+        simd::InverseBatch(in.data(), out.data(), count);
+
+        CHECK(out == expected);
+    }
+
+    Select(Detect());
+}
+
+// A word that only brings + - * and ==, like the sse_int words, so Inverse takes its class path.
+//
+
+template <typename U> struct class_word
+{
+    U v;
+
+    constexpr class_word(U _v = 0) : v(_v) {}
+
+    constexpr class_word operator+(const class_word& o) const { return class_word(U(v + o.v)); }
+    constexpr class_word operator-(const class_word& o) const { return class_word(U(v - o.v)); }
+    constexpr class_word operator*(const class_word& o) const { return class_word(U(v * o.v)); }
+
+    constexpr bool operator==(const class_word& o) const { return v == o.v; }
+};
+
+template <typename U> void test_class_inverse(size_t count)
+{
+    using W = class_word<U>;
+
+    static_assert(std::is_class<W>() && template_crypto::math::inverse_start_bits<W>() == 3);
+    static_assert(W(37) * template_crypto::math::Inverse(W(37)) == W(1));
+
+    auto rv = d8u::random::Vector<uint8_t>(sizeof(U) * count);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        U u;
+        std::memcpy(&u, rv.data() + i * sizeof(U), sizeof(U));
+
+        W a(u | U(1));
+
+        CHECK(a * template_crypto::math::Inverse(a) == W(1));
+        CHECK(a * template_crypto::math::GetInverse(a) == W(1));
+    }
+}
+
+TEST_CASE("Inverse Batch", "[tcrypt::]")
+{
+    test_inverse<uint8_t>(37);
+    test_inverse<uint16_t>(37);
+    test_inverse<uint32_t>(37);
+    test_inverse<uint64_t>(37);
+#if defined(__SIZEOF_INT128__)
+    test_inverse<unsigned __int128>(37);
+#endif
+
+    CHECK(template_crypto::math::Inverse(uint64_t(1)) == 1);
+    CHECK(template_crypto::math::Inverse(uint64_t(0) - 1) == uint64_t(0) - 1);
+
+    test_class_inverse<uint32_t>(37);
+    test_class_inverse<uint64_t>(37);
+#if defined(__SIZEOF_INT128__)
+    test_class_inverse<unsigned __int128>(37);
+#endif
+}
+
+template <typename T, size_t L> void test_layout(std::array<T, L> key)
+{
+    using namespace template_crypto::math;
+
+    static PascalTriangle<T, L> pt;
+    static PascalTriangle<T, L, Layout::Padded> ptp;
+
+    ElectiveTransform<T, L> et(key);
+    ElectiveTransform<T, L, Layout::Padded> etp(key);
+
+    ElectiveSymmetry<L, T, L> es(key);
+    ElectiveSymmetry<L, T, L, Layout::Padded> esp(key);
+
+    for (size_t i = 0; i < L; i++)
+    {
+        CHECK((uintptr_t)ptp[i] % row_align == 0);
+        CHECK((uintptr_t)etp[i] % row_align == 0);
+        CHECK((uintptr_t)esp.Row(i) % row_align == 0);
+
+        for (size_t j = 0; j < i + 1; j++)
+        {
+            CHECK(pt[i][j] == ptp[i][j]);
+            CHECK(et[i][j] == etp[i][j]);
+        }
+
+        for (size_t j = i + 1; j < ptp.stride; j++)
+            CHECK(ptp[i][j] == 0);
+
+        for (size_t p = 0; p < L; p++)
+        {
+            CHECK(es[i][p] == esp[i][p]);
+            CHECK(esp.Row(i)[p] == es[i][L - 1 - p]);
+        }
+    }
+
+    CHECK(et.inverse() == etp.inverse());
+
+    auto rv = d8u::random::Vector<uint8_t>(sizeof(T) * L * 19);
+    auto block_p = (std::array<T, L>*)rv.data();
+
+    std::array<std::array<T, L>, 19> r1, r2;
+
+    for (size_t i = 0; i < r1.size(); i++)
+    {
+        std::array<T, L> a, b;
+
+        ToPascal(block_p[i], a, pt);
+        ToPascal(block_p[i], b, ptp);
+
+        CHECK(a == b);
+
+        ToPolynomial(a, r1[i], et);
+        ToPolynomial(a, r2[i], etp);
+
+        CHECK(r1[i] == r2[i]);
+
+        ToFunction(block_p[i], r1[i], es);
+        ToFunction(block_p[i], r2[i], esp);
+
+        CHECK(r1[i] == r2[i]);
+    }
+
+    template_crypto::simd::ToFunctionBatch(block_p, r2.data(), r2.size(), esp);
+
+    CHECK(r1 == r2);
+}
+
+TEST_CASE("Padded Layout", "[tcrypt::]")
+{
+    test_layout(std::array<uint8_t, 5> { 6, 5, 2, 9, 1 });
+    test_layout(std::array<uint16_t, 6> { 73, 23, 63, 23, 63, 99 });
+    test_layout(std::array<uint32_t, 8> { 73, 23, 63, 23, 73, 23, 63, 23 });
+    test_layout(std::array<uint64_t, 16> { 72, 23, 63, 23, 73, 23, 63, 23, 1, 2, 3, 4, 5, 6, 7, 8 });
+
+    static constexpr template_crypto::math::ElectiveSymmetry<4, uint64_t, 4, template_crypto::math::Layout::Padded> es(std::array<uint64_t, 4>{ 73, 23, 63, 23 });
+
+    static_assert(es[0][0] == 73 && es.Row(0)[3] == 73);
+
+    using namespace template_crypto::block;
+
+    constexpr std::array<uint32_t, 8> key{ 73, 23, 63, 23, 11, 5, 99, 7 };
+
+    DecodeContextShort<uint32_t, 8> dc(key);
+    DecodeContextShort<uint32_t, 8, template_crypto::math::Layout::Padded> dcp(key);
+
+    auto rv = d8u::random::Vector<uint8_t>(sizeof(uint32_t) * 8 * 37);
+    auto block_p = (std::array<uint32_t, 8>*)rv.data();
+
+    std::array<std::array<uint32_t, 8>, 37> r1, r2;
+
+    dc.Run(block_p, r1.data(), r1.size());
+    dcp.Run(block_p, r2.data(), r2.size());
+
+    CHECK(r1 == r2);
+}
+
+template <typename T, size_t L> void test_gemm(size_t size)
+{
+    using namespace template_crypto;
+    using namespace template_crypto::cpu;
+
+    std::array<T, L> key, iv;
+
+    for (size_t i = 0; i < L; i++)
+    {
+        key[i] = T(73 + 10 * i);
+        iv[i] = T(46 + 7 * i);
+    }
+
+    encrypt::Long<T, L, true> lec(key, iv);
+    decrypt::Long<T, L, true> ldc(key, iv);
+
+    auto rv = d8u::random::Vector<uint8_t>(size);
+    const d8u::aligned_vector original(rv.begin(), rv.end());
+
+    d8u::aligned_vector ciphertext = original;
+    lec.Encrypt(ciphertext);
+
+    Select(Kernel::Scalar);
+
+    d8u::aligned_vector expected = ciphertext;
+    ldc.Decrypt(expected);
+
+    CHECK(expected == original);
+
+    for (auto k : { Kernel::Avx2, Kernel::Avx512 })
+    {
+        if (Select(k) != k)
+            continue;
+
+        d8u::aligned_vector data = ciphertext, copy(ciphertext.size());
+
+        ldc.Decrypt(data);
+        ldc.Decrypt(ciphertext, copy);
+
+        CHECK(data == original);
+        CHECK(copy == original);
+    }
+
+    Select(Detect());
+}
+
+TEST_CASE("Decrypt Gemm", "[tcrypt::]")
+{
+    constexpr size_t size = 3 * template_crypto::simd::gemm_chunk + 5 * 512 + 77;
+
+    test_gemm<uint32_t, 16>(size);
+    test_gemm<uint32_t, 32>(size);
+    test_gemm<uint32_t, 48>(size);
+    test_gemm<uint32_t, 64>(size);
+    test_gemm<uint64_t, 16>(size);
+    test_gemm<uint64_t, 32>(size);
+    test_gemm<uint64_t, 64>(size);
+    test_gemm<uint64_t, 128>(size);
+}
@@ -2,6 +2,10 @@
 
 #ifdef TEST_RUNNER
 
+// Contract violations throw under test, so a precondition can be checked without ending the run.
+//
+
+#define gsl_CONFIG_CONTRACT_VIOLATION_THROWS
 
 #define CATCH_CONFIG_RUNNER
 #include "catch.hpp"
@@ -12,6 +16,369 @@ int main(int argc, char* argv[])
     return Catch::Session().run(argc, argv);
 }
 
+#elif defined(BENCH_RUNNER)
+
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "tcrypt/bench.hpp"
+
+using namespace template_crypto;
+
+int main(int argc, char* argv[])
+{
+    bench::Options options;
+    bool json = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool more = i + 1 < argc;
+
+        if (arg == "--json")
+            json = true;
+        else if (arg == "--csv")
+            json = false;
+        else if (arg == "--min" && more)
+            options.min_bytes = std::stoull(argv[++i]);
+        else if (arg == "--max" && more)
+            options.max_bytes = std::stoull(argv[++i]);
+        else if (arg == "--samples" && more)
+            options.samples = std::max(size_t(1), (size_t)std::stoull(argv[++i]));
+        else if (arg == "--warmup" && more)
+            options.warmup = std::stoull(argv[++i]);
+        else if (arg == "--cpu" && more)
+            options.cpu = std::stoi(argv[++i]);
+        else if (arg == "--type" && more)
+            options.type = argv[++i];
+        else if (arg == "--block" && more)
+            options.block = std::stoull(argv[++i]);
+        else if (arg == "--op" && more)
+            options.op = argv[++i];
+        else if (arg == "--kernel" && more)
+        {
+            std::string name = argv[++i];
+
+            for (int k = 0; k <= (int)cpu::Kernel::Avx512; k++)
+            {
+                if (name == cpu::Name((cpu::Kernel)k))
+                    cpu::Select((cpu::Kernel)k);
+            }
+        }
+        else
+        {
+            std::cerr << "usage: template_crypto [--csv|--json] [--min bytes] [--max bytes] [--samples n] [--warmup n] [--cpu n|-1]" << std::endl;
+            std::cerr << "       [--type u8|u16|u32|u64|u128] [--block n] [--op setup|encrypt|decrypt] [--kernel scalar|sse4.1|avx2|avx512]" << std::endl;
+            return 1;
+        }
+    }
+
+    int pinned = bench::Pin(options.cpu);
+
+    auto results = bench::Run(options);
+
+    if (json)
+        bench::WriteJson(std::cout, results, pinned);
+    else
+        bench::WriteCsv(std::cout, results);
+
+#if defined(TCRYPT_PERF)
+    perf::Report(std::cerr);
+#endif
+
+    return 0;
+}
+
 #else
 
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <string>
+
+#include "tcrypt/encrypt.hpp"
+#include "tcrypt/decrypt.hpp"
+#include "tcrypt/container.hpp"
+#include "tcrypt/mapped.hpp"
+#include "tcrypt/pipeline.hpp"
+
+#if defined(_WIN32)
+#include <fcntl.h>
+#endif
+
+using namespace template_crypto;
+
+using INT = uint64_t;
+constexpr size_t side = 4;
+
+// Read a key or iv of exactly one block from hex.
+//
+
+bool ParseBlock(const char* hex, std::array<INT, side>& out)
+{
+    constexpr size_t bytes = sizeof(INT) * side;
+
+    if (std::strlen(hex) != 2 * bytes)
+        return false;
+
+    uint8_t raw[bytes];
+    auto wipe_raw = gsl::finally([&] { block::Wipe(raw); });
+
+    for (size_t i = 0; i < bytes; i++)
+    {
+        auto nibble = [](char c) -> int
+        {
+            if (c >= '0' && c <= '9') return c - '0';
+            if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+            if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+            return -1;
+        };
+
+        int high = nibble(hex[2 * i]), low = nibble(hex[2 * i + 1]);
+
+        if (high < 0 || low < 0)
+            return false;
+
+        raw[i] = uint8_t(high << 4 | low);
+    }
+
+    std::memcpy(out.data(), raw, bytes);
+
+    return true;
+}
+
+// Read the key as hex from a file, or stdin when path is -, so it never shows in the process list or the shell history.
+// Trailing whitespace such as a newline is ignored.
+//
+
+bool ReadKey(const char* path, std::array<INT, side>& key)
+{
+    bool console = std::strcmp(path, "-") == 0;
+    FILE* file = console ? stdin : std::fopen(path, "rb");
+
+    if (!file)
+        return false;
+
+    char hex[4 * sizeof(INT) * side + 1];
+    size_t length = std::fread(hex, 1, sizeof(hex) - 1, file);
+
+    if (!console)
+        std::fclose(file);
+
+    while (length && hex[length - 1] && std::strchr(" \t\r\n", hex[length - 1]))
+        length--;
+
+    hex[length] = 0;
+
+    bool ok = ParseBlock(hex, key);
+    block::Wipe(hex);
+
+    return ok;
+}
+
+// Decimal thread count, the whole argument must parse.
+//
+
+bool ParseCount(const char* text, size_t& out)
+{
+    char* end = nullptr;
+    errno = 0;
+
+    unsigned long long value = std::strtoull(text, &end, 10);
+
+    if (!*text || *end || errno == ERANGE || *text == '-' || value > SIZE_MAX)
+        return false;
+
+    out = (size_t)value;
+
+    return true;
+}
+
+int Usage()
+{
+    std::cerr << "usage: template_crypto encrypt|decrypt|pack|unpack <key file> <iv hex> <input> [output] [threads] [--stats]" << std::endl;
+    std::cerr << "  key file          holds the key in hex, - reads it from stdin" << std::endl;
+    std::cerr << "  encrypt, decrypt  CBC, in place when output is omitted or -, stdin to stdout when input is -" << std::endl;
+    std::cerr << "  pack, unpack      chunked container, output required and never the input" << std::endl;
+    std::cerr << "  --stats           print where a piped run stalled" << std::endl;
+
+    return 1;
+}
+
+int main(int argc, char* argv[])
+{
+    // --stats may come anywhere, it is taken out before the positional arguments are read.
+    //
+
+    bool report = false;
+
+    for (int i = 1; i < argc;)
+    {
+        if (std::strcmp(argv[i], "--stats") != 0)
+        {
+            i++;
+            continue;
+        }
+
+        report = true;
+
+        std::copy(argv + i + 1, argv + argc, argv + i);
+        argc--;
+    }
+
+    if (argc < 5)
+        return Usage();
+
+    std::string mode = argv[1];
+    std::array<INT, side> key, iv;
+
+    // Every return from here on, early or not, leaves no key behind.
+    //
+
+    auto wipe_key = gsl::finally([&] { block::Wipe(key); });
+
+    const char* input = argv[4];
+    const char* output = (argc > 5 && std::strcmp(argv[5], "-") != 0) ? argv[5] : nullptr;
+    size_t threads = 0;
+
+    bool packing = mode == "pack" || mode == "unpack";
+
+    if ((!packing && mode != "encrypt" && mode != "decrypt") || (packing && !output))
+        return Usage();
+
+    if (argc > 6 && !ParseCount(argv[6], threads))
+        return Usage();
+
+    // stdin carries either the key or the data, not both.
+    //
+
+    if (std::strcmp(argv[2], "-") == 0 && std::strcmp(input, "-") == 0)
+        return Usage();
+
+    if (!ReadKey(argv[2], key) || !ParseBlock(argv[3], iv))
+    {
+        std::cerr << "key and iv must be " << 2 * sizeof(INT) * side << " hex digits" << std::endl;
+        return 1;
+    }
+
+    // Pipes cannot be mapped, they go through the reader, cipher and writer threads instead.
+    //
+
+    if (std::strcmp(input, "-") == 0)
+    {
+        if (packing)
+            return Usage();
+
+#if defined(_WIN32)
+        _setmode(0, _O_BINARY);
+        _setmode(1, _O_BINARY);
+#endif
+        auto stats = (mode == "encrypt")
+            ? pipeline::Run(encrypt::Long<INT, side>(key, iv), 0, 1, 1024 * 1024, 4)
+            : pipeline::Run(decrypt::Long<INT, side>(key, iv), 0, 1, 1024 * 1024, 4);
+
+        if (!stats.ok)
+        {
+            std::cerr << "pipe failed" << std::endl;
+            return 2;
+        }
+
+        if (report)
+            std::cerr << "stalls read " << stats.read.stalls << " crypt " << stats.crypt.stalls << " write " << stats.write.stalls << std::endl;
+
+        return 0;
+    }
+
+    // Both sides are mapped, nothing is read into or written from a private buffer.
+    //
+
+    mapped::File in, out;
+
+    if (!in.Open(input, !output))
+    {
+        std::cerr << "cannot open " << input << std::endl;
+        return 2;
+    }
+
+    in.Sequential();
+
+    size_t size = in.size();
+
+    if (mode == "pack")
+        size = container::Long<INT, side>::Size(in.size());
+    else if (mode == "unpack")
+    {
+        auto source = in.span();
+        size = container::Long<INT, side>::PayloadSize(source);
+
+        if (!size && in.size() != container::Long<INT, side>::Size(0))
+        {
+            std::cerr << input << " is not a container" << std::endl;
+            return 3;
+        }
+    }
+
+    if (output)
+    {
+        // Creating the output truncates it, which would destroy the input if both name the same file.
+        //
+
+        std::error_code ec;
+
+        if (std::filesystem::equivalent(input, output, ec))
+        {
+            std::cerr << "output must not be the input, omit it to work in place" << std::endl;
+            return 1;
+        }
+
+        if (!out.Create(output, size))
+        {
+            std::cerr << "cannot create " << output << std::endl;
+            return 2;
+        }
+
+        out.Sequential();
+    }
+
+    mapped::File& target = output ? out : in;
+
+    auto source = in.span();
+    auto destination = target.span();
+
+    if (mode == "encrypt")
+    {
+        // The chain is serial, the block function runs batched on one core.
+        //
+
+        encrypt::Long<INT, side>(key, iv).Encrypt(in.data(), target.data(), in.size());
+    }
+    else if (mode == "decrypt")
+        decrypt::Long<INT, side>(key, iv).DecryptParallel(in.data(), target.data(), in.size(), threads);
+    else
+    {
+        container::Long<INT, side> cl(key, iv);
+
+        if (mode == "pack")
+            cl.Encrypt(source, destination, container::default_chunk, threads);
+        else if (!cl.Decrypt(source, destination, threads))
+        {
+            std::cerr << input << " is not a container" << std::endl;
+            return 3;
+        }
+    }
+
+    if (!target.Flush())
+    {
+        std::cerr << "cannot flush " << (output ? output : input) << std::endl;
+        return 2;
+    }
+
+    return 0;
+}
+
 #endif //TEST_RUNNER
\ No newline at end of file